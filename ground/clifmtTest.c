@@ -0,0 +1,115 @@
+/*
+    This file is part of AutoQuad ESC32.
+
+    AutoQuad ESC32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AutoQuad ESC32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License
+    along with AutoQuad ESC32.  If not, see <http://www.gnu.org/licenses/>.
+
+    Copyright © 2011, 2012, 2013  Bill Nesbitt
+*/
+
+// Compares the firmware's CLI number formatter against the host libc.
+
+#include "../onboard/clifmt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define TEST_RANDOM	200000
+
+int testFailed;
+int testRun;
+
+// every float format in configFormatStrings and the CLI
+const char *testFloatFormats[] = {
+    "%+e",
+    "%f",
+    "%.0f",
+    "%.1f",
+    "%.2f",
+    "%.3f",
+    "%.5f",
+    "%2.2f",
+    "%10.2f",
+    "%8.2f",
+    "%6.0f",
+    "%.1f %%"
+};
+
+#define TEST_NUM_FORMATS (sizeof(testFloatFormats) / sizeof(testFloatFormats[0]))
+
+void testFloat(const char *fmt, float f) {
+    char ours[64], libc[64];
+
+    cliSprintf(ours, fmt, f);
+    sprintf(libc, fmt, f);
+    testRun++;
+
+    if (strcmp(ours, libc)) {
+	if (testFailed < 20)
+	    printf("%-8s %.9g: '%s' != '%s'\n", fmt, f, ours, libc);
+	testFailed++;
+    }
+}
+
+float testRandomFloat(void) {
+    uint32_t bits;
+    float f;
+
+    do {
+	bits = (uint32_t)rand() << 16 ^ (uint32_t)rand();
+	memcpy(&f, &bits, sizeof(f));
+    } while (isnan(f) || isinf(f));
+
+    return f;
+}
+
+int main(void) {
+    char ours[64], libc[64];
+    float f;
+    int i, j;
+
+    srand(1);
+
+    // any finite float in exponent form
+    for (i = 0; i < TEST_RANDOM; i++)
+	testFloat("%+e", testRandomFloat());
+
+    // calibration constants are small
+    for (i = 0; i < TEST_RANDOM; i++)
+	testFloat("%+e", (rand() / (float)RAND_MAX - 0.5f) * powf(10.0f, rand() % 20 - 14));
+
+    // fixed point over the range it handles, and a decade either side of typical values
+    for (i = 0; i < TEST_RANDOM; i++) {
+	f = (rand() / (float)RAND_MAX - 0.5f) * powf(10.0f, rand() % 14 - 4);
+	for (j = 0; j < (int)TEST_NUM_FORMATS; j++)
+	    testFloat(testFloatFormats[j], f);
+    }
+
+    // halfway cases round to even
+    for (i = 0; i < 1000; i++)
+	for (j = 0; j < (int)TEST_NUM_FORMATS; j++)
+	    testFloat(testFloatFormats[j], i / 8.0f);
+
+    // the rest of the CLI's formats
+    cliSprintf(ours, "%-12s%10d|%3d%8d%u|%10s|%%", "BAD DETECTS", -42, 1, 2, 4000000000u, "RUNNING");
+    sprintf(libc, "%-12s%10d|%3d%8d%u|%10s|%%", "BAD DETECTS", -42, 1, 2, 4000000000u, "RUNNING");
+    testRun++;
+    if (strcmp(ours, libc)) {
+	printf("'%s' != '%s'\n", ours, libc);
+	testFailed++;
+    }
+
+    printf("clifmtTest: %d of %d differ from libc\n", testFailed, testRun);
+
+    return testFailed ? 1 : 0;
+}
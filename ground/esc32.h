@@ -36,10 +36,84 @@ enum binaryCommands {
     BINARY_COMMAND_VERSION,
     BINARY_COMMAND_TELEM_VALUE,
     BINARY_COMMAND_GET_PARAM_ID,
+    BINARY_COMMAND_TELEM_FORMAT,
+    BINARY_COMMAND_GET_PARAMS,
+    BINARY_COMMAND_SET_PARAMS,
+    BINARY_COMMAND_TELEM_DIVIDER,
+    BINARY_COMMAND_TELEM_STATS,
+    BINARY_COMMAND_TELEM_STATS_RATE,
+    BINARY_COMMAND_CAPTURE_VALUE,
+    BINARY_COMMAND_CAPTURE_ARM,
+    BINARY_COMMAND_CAPTURE_READ,
     BINARY_COMMAND_ACK = 250,
     BINARY_COMMAND_NACK
 };
 
+enum binaryTelemFormats {
+    BINARY_TELEM_FLOAT = 1,
+    BINARY_TELEM_FIXED
+};
+
+#define BINARY_TELEM_DELTA_ESC	    -128
+
+#define BINARY_PARAMS_PER_FRAME	    32
+#define BINARY_STATS_NUM	    4
+#define BINARY_STATS_BINS	    8
+#define BINARY_CAPTURE_SIZE	    2048
+#define BINARY_CAPTURE_COLS	    4
+
+enum binaryCaptureTriggers {
+    BINARY_CAPTURE_OFF = 0,
+    BINARY_CAPTURE_NOW,
+    BINARY_CAPTURE_SETPOINT,
+    BINARY_CAPTURE_CURRENT,
+    BINARY_CAPTURE_DISARM
+};
+
+#define ESC32_WINDOW		16	    // commands in flight, within the ESC's response queue
+#define ESC32_SEQ_SLOTS		256	    // response slots, indexed by seqId
+#define ESC32_TIMEOUT		500	    // ms before a command is resent
+#define ESC32_RETRIES		5
+
+enum esc32Responses {
+    ESC32_PENDING = 0,
+    ESC32_ACK,
+    ESC32_NACK
+};
+
+// one signal's on-board summary
+typedef struct {
+    unsigned char value;
+    float min, max, mean, rms;
+    unsigned short bins[BINARY_STATS_BINS];
+} esc32Stats_t;
+
+typedef struct {
+    unsigned int micros;
+    unsigned char state;
+    unsigned char runMode;
+    unsigned char inputMode;
+    unsigned char disarmReason;
+    float rpm;
+    float amps;
+    float volts;
+    float duty;
+    unsigned int badDetects;
+    float idlePercent;
+} __attribute__((packed)) binaryStatus_t;
+
+typedef struct {
+    char version[16];
+    float configVersion;
+} __attribute__((packed)) binaryVersion_t;
+
+typedef struct {
+    unsigned char command;
+    float param1, param2;
+    int n;
+    int result;			    // ESC32_PENDING if never answered
+} esc32Command_t;
+
 enum binaryValues {
     BINARY_VALUE_NONE = 0,
     BINARY_VALUE_AMPS,
@@ -57,6 +131,11 @@ enum binaryValues {
     BINARY_VALUE_AVGC,
     BINARY_VALUE_AVGCOMP,
     BINARY_VALUE_FETSTEP,
+    BINARY_VALUE_START_TIME,
+    BINARY_VALUE_FIRST_DETECT_TIME,
+    BINARY_VALUE_FAILED_STARTS,
+    BINARY_VALUE_REVERSE_TIME,
+    BINARY_VALUE_CMD_LATENCY,
     BINARY_VALUE_NUM
 };
 
@@ -111,5 +190,12 @@ enum configParameters {
     SERVO_SCALE,
     ESC_ID,
     DIRECTION,
+    SWITCH_FREQ_MIN,
+    SWITCH_FREQ_DUTY,
+    START_SENSE,
+    START_SENSE_MICROS,
+    START_CATCH,
+    BIDIRECTIONAL,
+    BIDIR_DEADBAND,
     CONFIG_NUM_PARAMS
 };
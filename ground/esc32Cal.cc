@@ -18,6 +18,7 @@
 
 #include "esc32.h"
 #include "serial.h"
+#include "../onboard/xxhash.h"
 #include "plplot/plplot.h"
 #include <stdio.h>
 #include <unistd.h>
@@ -46,19 +47,40 @@ using namespace Eigen;
 
 unsigned char checkInA, checkInB;
 unsigned char checkOutA, checkOutB;
-char sendBuf[128];
+char sendBuf[256];
 unsigned char sendBufPtr;
 volatile float telemValueAvgs[BINARY_VALUE_NUM];
 volatile float telemValueMaxs[BINARY_VALUE_NUM];
 volatile float telemData[256][BINARY_VALUE_NUM];
+unsigned char telemColValues[BINARY_VALUE_NUM];
+unsigned short telemSeq;
+unsigned int telemLostFrames;
+int telemFixed, telemDelta;
 float *telemStorage;
 volatile int telemStorageNum;
 float maxAmps;
 int runR2V, runCL;
 FILE* telemOutFile;
-volatile unsigned char lastAck;
-volatile unsigned short lastSeqId = -1;
-volatile short paramId;
+volatile unsigned char respStatus[ESC32_SEQ_SLOTS];
+volatile short respParamId[ESC32_SEQ_SLOTS];
+volatile float paramValues[CONFIG_NUM_PARAMS];
+volatile unsigned char paramRcvd[CONFIG_NUM_PARAMS];
+volatile unsigned short paramSeqId;
+volatile unsigned int paramHash;
+volatile float paramVersion;
+binaryStatus_t statusReply;
+esc32Stats_t telemStats[BINARY_STATS_NUM];
+volatile int telemStatsNum;
+unsigned short telemStatsSeq;
+short captureData[BINARY_CAPTURE_SIZE];
+volatile unsigned char captureRcvd[BINARY_CAPTURE_SIZE];
+volatile int captureRows, captureCols, captureRcvdNum;
+int captureTrigRow, captureRate;
+unsigned char captureValues[BINARY_CAPTURE_COLS];
+unsigned short captureSeq = 0xffff;
+int runCapture;
+binaryVersion_t versionReply;
+char *paramSaveFile, *paramLoadFile;
 pthread_t threadIn;
 pthread_mutex_t threadMutex = PTHREAD_MUTEX_INITIALIZER;
 serialStruct_t *s;
@@ -67,6 +89,31 @@ unsigned short commandSeqId = 1;
 char port[256];
 unsigned int baud;
 
+// fixed point telemetry - counts per natural unit, must match the ESC
+const float telemScale[BINARY_VALUE_NUM] = {
+	1.0f,		// NONE
+	100.0f,		// AMPS
+	100.0f,		// VOLTS_BAT
+	100.0f,		// VOLTS_MOTOR
+	1.0f,		// RPM
+	10000.0f,	// DUTY
+	1.0f,		// COMM_PERIOD
+	1.0f,		// BAD_DETECTS
+	1.0f,		// ADC_WINDOW
+	100.0f,		// IDLE_PERCENT
+	1.0f,		// STATE
+	0.0625f,	// AVGA
+	0.0625f,	// AVGB
+	0.0625f,	// AVGC
+	0.0625f,	// AVGCOMP
+	1.0f,		// FETSTEP
+	0.001f,		// START_TIME
+	0.001f,		// FIRST_DETECT_TIME
+	1.0f,		// FAILED_STARTS
+	0.001f,		// REVERSE_TIME
+	1.0f		// CMD_LATENCY
+};
+
 void esc32Send(void) {
 	serialWrite(s, sendBuf, sendBufPtr);
 }
@@ -133,10 +180,68 @@ float esc32GetFloat(serialStruct_t *s) {
 	return f;
 }
 
+// CRC16-CCITT (0x1021)
+unsigned short esc32Crc16(const unsigned char *buf, int len, unsigned short crc) {
+	int i;
+
+	while (len--) {
+		crc ^= (unsigned short)*buf++ << 8;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+	}
+
+	return crc;
+}
+
+void esc32TelemRows(int rows, int cols) {
+	int i, j;
+
+	// update averages
+	for (i = 0; i < rows; i++)
+		for (j = 0; j < cols; j++)
+			telemValueAvgs[j] -= (telemValueAvgs[j] - telemData[i][j]) * 0.01;
+
+	// update max values
+	for (i = 0; i < rows; i++)
+		for (j = 0; j < cols; j++)
+			if (telemValueMaxs[j] < telemData[i][j])
+				telemValueMaxs[j] = telemData[i][j];
+
+	// save to memory
+	for (i = 0; i < rows; i++) {
+		for (j = 0; j < cols; j++)
+			telemStorage[MAX_TELEM_STORAGE*j + telemStorageNum] = telemData[i][j];
+		telemStorageNum++;
+	}
+
+	// output to stream
+	if (telemOutFile) {
+		for (i = 0; i < rows; i++) {
+			for (j = 0; j < cols; j++) {
+				if (j != 0)
+					fprintf(telemOutFile, ", ");
+				fprintf(telemOutFile, "%f", telemData[i][j]);
+			}
+			fprintf(telemOutFile, "\n");
+			fflush(telemOutFile);
+		}
+	}
+}
+
 void *esc32Read(void *ipt) {
 	unsigned short seqId;
         unsigned char c;
 	int rows, cols;
+	int delta;
+	short last[BINARY_VALUE_NUM];
+	unsigned char frame[4096];
+	unsigned char *p;
+#ifdef ESC32_DEBUG
+	unsigned int timestamp;
+#endif
+	unsigned short sample;
+	unsigned char *div;
+	unsigned int sent;
 	int n;
         int i, j;
 
@@ -159,8 +264,9 @@ void *esc32Read(void *ipt) {
 			c = esc32GetChar(s);	// command
 			seqId = esc32GetShort(s);
 
-			if (n > 3)
-				paramId = esc32GetShort(s);
+			// reply payload
+			for (i = 0; i < n - 3; i++)
+				frame[i] = esc32GetChar(s);
 
 			if (serialRead(s) != checkInA)
 				goto thread_read_start;
@@ -168,22 +274,30 @@ void *esc32Read(void *ipt) {
 			if (serialRead(s) != checkInB)
 				goto thread_read_start;
 
+			// responses may arrive in any order, matched by seqId
 			if (c == BINARY_COMMAND_ACK) {
-				lastSeqId = seqId;
-				lastAck = 1;
+				respStatus[seqId % ESC32_SEQ_SLOTS] = ESC32_ACK;
 #ifdef ESC32_DEBUG
 				printf("Ack [%d]\n", seqId);
 #endif
 			}
 			else if (c == BINARY_COMMAND_NACK) {
-				lastSeqId = seqId;
-				lastAck = 0;
+				respStatus[seqId % ESC32_SEQ_SLOTS] = ESC32_NACK;
 #ifdef ESC32_DEBUG
 				printf("Nack [%d]\n", seqId);
 #endif
 			}
 			else if (c == BINARY_COMMAND_GET_PARAM_ID) {
-				lastSeqId = seqId;
+				respParamId[seqId % ESC32_SEQ_SLOTS] = (short)(frame[0] | frame[1]<<8);
+				respStatus[seqId % ESC32_SEQ_SLOTS] = ESC32_ACK;
+			}
+			else if (c == BINARY_COMMAND_STATUS && n - 3 == sizeof(statusReply)) {
+				memcpy(&statusReply, frame, sizeof(statusReply));
+				respStatus[seqId % ESC32_SEQ_SLOTS] = ESC32_ACK;
+			}
+			else if (c == BINARY_COMMAND_VERSION && n - 3 == sizeof(versionReply)) {
+				memcpy(&versionReply, frame, sizeof(versionReply));
+				respStatus[seqId % ESC32_SEQ_SLOTS] = ESC32_ACK;
 			}
 			else {
 				printf("Unkown command [%d]\n", c);
@@ -203,43 +317,214 @@ void *esc32Read(void *ipt) {
 			if (serialRead(s) != checkInB)
 				goto thread_read_start;
 
-			// update averages
-			for (i = 0; i < rows; i++)
-				for (j = 0; j < cols; j++)
-					telemValueAvgs[j] -= (telemValueAvgs[j] - telemData[i][j]) * 0.01;
+			esc32TelemRows(rows, cols);
+		}
+		// fixed point telemetry, length delimited with CRC16
+		if (c == 'V') {
+			frame[0] = serialRead(s);
+			frame[1] = serialRead(s);
+			n = frame[0] | frame[1]<<8;
+			if (n > (int)sizeof(frame) - 4)
+				goto thread_read_start;
 
-			// update max values
-			for (i = 0; i < rows; i++)
-				for (j = 0; j < cols; j++)
-					if (telemValueMaxs[j] < telemData[i][j])
-						telemValueMaxs[j] = telemData[i][j];
+			for (i = 0; i < n + 2; i++)
+				frame[2 + i] = serialRead(s);
+
+			if (esc32Crc16(frame, n + 2, 0xffff) != (frame[n+2] | frame[n+3]<<8))
+				goto thread_read_start;
 
-			// save to memory
+			p = frame + 2;
+			rows = *p++;
+			cols = *p++;
+			delta = *p++;
+			seqId = p[0] | p[1]<<8;
+#ifdef ESC32_DEBUG
+			timestamp = p[2] | p[3]<<8 | p[4]<<16 | p[5]<<24;
+#endif
+			sample = p[6] | p[7]<<8;
+			p += 8;
+			div = p;
+			p += cols;
+
+			// a column is only in the rows its divider makes due,
+			// other rows hold its last value
+			sent = 0;
 			for (i = 0; i < rows; i++) {
-				for (j = 0; j < cols; j++)
-					telemStorage[MAX_TELEM_STORAGE*j + telemStorageNum] = telemData[i][j];
-				telemStorageNum++;
+				for (j = 0; j < cols; j++) {
+					if (!((unsigned short)(sample + i) % div[j])) {
+						if (delta && (sent & (1<<j)) && (signed char)*p != BINARY_TELEM_DELTA_ESC) {
+							last[j] += (signed char)*p++;
+						}
+						else {
+							if (delta && (sent & (1<<j)))
+								p++;
+							last[j] = (short)(p[0] | p[1]<<8);
+							p += 2;
+						}
+						sent |= (1<<j);
+					}
+
+					telemData[i][j] = last[j] / telemScale[telemColValues[j]];
+				}
 			}
 
-			// output to stream
-			if (telemOutFile) {
-				for (i = 0; i < rows; i++) {
-					for (j = 0; j < cols; j++) {
-						if (j != 0)
-							fprintf(telemOutFile, ", ");
-						fprintf(telemOutFile, "%f", telemData[i][j]);
-					}
-					fprintf(telemOutFile, "\n");
-					fflush(telemOutFile);
+			if (seqId != telemSeq)
+				telemLostFrames += (unsigned short)(seqId - telemSeq);
+			telemSeq = seqId + 1;
+#ifdef ESC32_DEBUG
+			printf("Telem [%d] @ %u us, %u lost\n", seqId, timestamp, telemLostFrames);
+#endif
+
+			esc32TelemRows(rows, cols);
+		}
+		// on-board aggregated telemetry, length delimited with CRC16
+		if (c == 'A') {
+#ifdef ESC32_DEBUG
+			unsigned short samples;
+#endif
+
+			frame[0] = serialRead(s);
+			frame[1] = serialRead(s);
+			n = frame[0] | frame[1]<<8;
+			if (n > (int)sizeof(frame) - 4)
+				goto thread_read_start;
+
+			for (i = 0; i < n + 2; i++)
+				frame[2 + i] = serialRead(s);
+
+			if (esc32Crc16(frame, n + 2, 0xffff) != (frame[n+2] | frame[n+3]<<8))
+				goto thread_read_start;
+
+			p = frame + 2;
+			telemStatsSeq = p[0] | p[1]<<8;
+#ifdef ESC32_DEBUG
+			timestamp = p[2] | p[3]<<8 | p[4]<<16 | p[5]<<24;
+			samples = p[6] | p[7]<<8;
+#endif
+			cols = p[8];
+			p += 9;
+
+			if (cols > BINARY_STATS_NUM)
+				goto thread_read_start;
+
+			for (j = 0; j < cols; j++) {
+				esc32Stats_t *st = &telemStats[j];
+
+				st->value = *p++;
+				memcpy(&st->min, p, sizeof(float));
+				memcpy(&st->max, p + 4, sizeof(float));
+				memcpy(&st->mean, p + 8, sizeof(float));
+				memcpy(&st->rms, p + 12, sizeof(float));
+				p += 16;
+
+				for (i = 0; i < BINARY_STATS_BINS; i++, p += 2)
+					st->bins[i] = p[0] | p[1]<<8;
+#ifdef ESC32_DEBUG
+				printf("Stats [%d] value %d: min %f max %f mean %f rms %f\n", telemStatsSeq, st->value, st->min, st->max, st->mean, st->rms);
+#endif
+			}
+			telemStatsNum = cols;
+#ifdef ESC32_DEBUG
+			printf("Stats [%d] @ %u us, %d samples\n", telemStatsSeq, timestamp, samples);
+#endif
+		}
+		// burst capture rows, length delimited with CRC16
+		if (c == 'B') {
+			int first, count;
+
+			frame[0] = serialRead(s);
+			frame[1] = serialRead(s);
+			n = frame[0] | frame[1]<<8;
+			if (n > (int)sizeof(frame) - 4)
+				goto thread_read_start;
+
+			for (i = 0; i < n + 2; i++)
+				frame[2 + i] = serialRead(s);
+
+			if (esc32Crc16(frame, n + 2, 0xffff) != (frame[n+2] | frame[n+3]<<8))
+				goto thread_read_start;
+
+			p = frame + 2;
+			seqId = p[0] | p[1]<<8;
+			rows = p[4] | p[5]<<8;
+			first = p[8] | p[9]<<8;
+			count = p[10];
+			cols = p[11];
+
+			if (cols == 0 || cols > BINARY_CAPTURE_COLS || rows * cols > BINARY_CAPTURE_SIZE || first + count > rows)
+				goto thread_read_start;
+
+			// a new capture
+			if (seqId != captureSeq) {
+				memset((void *)captureRcvd, 0, sizeof(captureRcvd));
+				captureRcvdNum = 0;
+				captureSeq = seqId;
+				captureRate = p[2] | p[3]<<8;
+				captureTrigRow = p[6] | p[7]<<8;
+				captureCols = cols;
+				captureRows = rows;
+				memcpy(captureValues, p + 12, cols);
+			}
+			p += 12 + cols;
+
+			for (i = first; i < first + count; i++) {
+				for (j = 0; j < cols; j++, p += 2)
+					captureData[i*cols + j] = (short)(p[0] | p[1]<<8);
+
+				if (!captureRcvd[i]) {
+					captureRcvd[i] = 1;
+					captureRcvdNum++;
 				}
 			}
+#ifdef ESC32_DEBUG
+			printf("Capture [%d] rows %d-%d of %d\n", seqId, first, first + count - 1, rows);
+#endif
+		}
+		// bulk parameter read, length delimited with CRC16
+		if (c == 'P') {
+			int first, count;
+			float f;
+
+			frame[0] = serialRead(s);
+			frame[1] = serialRead(s);
+			n = frame[0] | frame[1]<<8;
+			if (n > (int)sizeof(frame) - 4)
+				goto thread_read_start;
+
+			for (i = 0; i < n + 2; i++)
+				frame[2 + i] = serialRead(s);
+
+			if (esc32Crc16(frame, n + 2, 0xffff) != (frame[n+2] | frame[n+3]<<8))
+				goto thread_read_start;
+
+			p = frame + 2;
+			seqId = p[0] | p[1]<<8;
+			first = p[2];
+			count = p[3];
+
+			if (seqId != paramSeqId || first + count > CONFIG_NUM_PARAMS)
+				goto thread_read_start;
+
+			memcpy(&f, p + 6, sizeof(float));
+			paramVersion = f;
+			paramHash = p[10] | p[11]<<8 | p[12]<<16 | p[13]<<24;
+
+			for (i = 0; i < count; i++) {
+				memcpy(&f, p + 14 + i*sizeof(float), sizeof(float));
+				paramValues[first + i] = f;
+				paramRcvd[first + i] = 1;
+			}
 		}
 	}
 }
 
-unsigned short esc32SendCommand(unsigned char command, float param1, float param2, int n) {
+// up to 4 params
+unsigned short esc32SendCommandN(unsigned char command, const float *params, int n) {
+	int i;
+
 	checkOutA = checkOutB = 0;
 	sendBufPtr = 0;
+	respStatus[commandSeqId % ESC32_SEQ_SLOTS] = ESC32_PENDING;
 
 #ifdef ESC32_DEBUG
         printf("Send %d [%d] - ", command, commandSeqId);
@@ -249,10 +534,8 @@ unsigned short esc32SendCommand(unsigned char command, float param1, float param
         esc32SendChar(1 + 2 + n*sizeof(float));
         esc32SendChar(command);
         esc32SendShort(commandSeqId++);
-        if (n > 0)
-                esc32SendFloat(param1);
-        if (n > 1)
-                esc32SendFloat(param2);
+        for (i = 0; i < n; i++)
+                esc32SendFloat(params[i]);
         sendBuf[sendBufPtr++] = checkOutA;
         sendBuf[sendBufPtr++] = checkOutB;
         esc32Send();
@@ -263,8 +546,32 @@ unsigned short esc32SendCommand(unsigned char command, float param1, float param
 	return (commandSeqId - 1);
 }
 
+unsigned short esc32SendCommand(unsigned char command, float param1, float param2, int n) {
+	float params[2] = {param1, param2};
+
+	return esc32SendCommandN(command, params, n);
+}
+
+int esc32SendReliablyN(unsigned char command, const float *params, int n) {
+	unsigned short seqId;
+	int j, k;
+
+	for (j = 0; j < ESC32_RETRIES; j++) {
+		seqId = esc32SendCommandN(command, params, n);
+
+		k = 0;
+		while (respStatus[seqId % ESC32_SEQ_SLOTS] == ESC32_PENDING && k++ < ESC32_TIMEOUT)
+			usleep(1000);
+
+		if (respStatus[seqId % ESC32_SEQ_SLOTS] != ESC32_PENDING)
+			break;
+	}
+
+	return (respStatus[seqId % ESC32_SEQ_SLOTS] == ESC32_ACK);
+}
+
 void esc32Usage(void) {
-	fprintf(stderr, "usage: esc32Cal <-h> <-a amps> <-p device_file> <-b baud_rate> <-t telemtry_out_file> [--cl --r2v]\n");
+	fprintf(stderr, "usage: esc32Cal <-h> <-a amps> <-p device_file> <-b baud_rate> <-t telemtry_out_file> [--fixed] [--delta] [--save_params file] [--load_params file] [--capture] [--cl --r2v]\n");
 }
 
 unsigned int esc32Options(int argc, char **argv) {
@@ -283,10 +590,15 @@ unsigned int esc32Options(int argc, char **argv) {
 		{ "r2v",	no_argument,		NULL,           'r' },
 		{ "cl",		no_argument,		NULL,           'c' },
 		{ "telem_file",	required_argument,      NULL,           't' },
+		{ "fixed",	no_argument,		NULL,           'f' },
+		{ "delta",	no_argument,		NULL,           'd' },
+		{ "save_params", required_argument,	NULL,           'S' },
+		{ "load_params", required_argument,	NULL,           'L' },
+		{ "capture",	no_argument,		NULL,           'C' },
 		{ NULL,         0,                      NULL,           0 }
 	};
 
-	while ((ch = getopt_long(argc, argv, "hp:b:a:rct:", longopts, NULL)) != -1)
+	while ((ch = getopt_long(argc, argv, "hp:b:a:rct:fdS:L:C", longopts, NULL)) != -1)
 		switch (ch) {
 		case 'h':
 			esc32Usage();
@@ -307,6 +619,22 @@ unsigned int esc32Options(int argc, char **argv) {
 		case 'c':
 			runCL++;
 			break;
+		case 'f':
+			telemFixed++;
+			break;
+		case 'd':
+			telemFixed++;
+			telemDelta++;
+			break;
+		case 'C':
+			runCapture++;
+			break;
+		case 'S':
+			paramSaveFile = optarg;
+			break;
+		case 'L':
+			paramLoadFile = optarg;
+			break;
 		case 't':
 			telemOutFile = fopen(optarg, "w");
 			if (telemOutFile == NULL) {
@@ -321,45 +649,88 @@ unsigned int esc32Options(int argc, char **argv) {
 	argc -= optind;
 	argv += optind;
 
-	if (!runR2V && !runCL) {
-		fprintf(stderr, "esc32Cal: requires either --r2v or --cl option, aborting\n");
+	if (!runR2V && !runCL && !paramSaveFile && !paramLoadFile) {
+		fprintf(stderr, "esc32Cal: requires either --r2v, --cl, --save_params or --load_params option, aborting\n");
 		exit(0);
 	}
 	return 1;
 }
 
-int esc32SendReliably(unsigned char command, float param1, float param2, int n) {
-	unsigned short seqId;
-	int ret = 0;
-	int i, j;
+// keep up to ESC32_WINDOW commands in flight, resending any that time out.
+// Commands are executed in order unless one is lost and resent.
+int esc32SendPipelined(esc32Command_t *cmds, int num) {
+	unsigned short seqIds[ESC32_WINDOW];
+	int cmdIdx[ESC32_WINDOW];
+	int sent[ESC32_WINDOW];
+	int tries[ESC32_WINDOW];
+	int inFlight = 0;
+	int next = 0;
+	int acked = 0;
+	int i;
 
-	j = 0;
-	do {
-		seqId = esc32SendCommand(command, param1, param2, n);
+	while (next < num || inFlight) {
+		// fill the window
+		while (next < num && inFlight < ESC32_WINDOW) {
+			cmds[next].result = ESC32_PENDING;
+			cmdIdx[inFlight] = next;
+			seqIds[inFlight] = esc32SendCommand(cmds[next].command, cmds[next].param1, cmds[next].param2, cmds[next].n);
+			sent[inFlight] = 0;
+			tries[inFlight] = 1;
+			inFlight++;
+			next++;
+		}
 
-		i = 0;
-		do {
-			usleep(1000);
-			i++;
-		} while (lastSeqId != seqId && i < 500);
+		usleep(1000);
 
-		j++;
-	} while (lastSeqId != seqId && j < 5);
+		for (i = 0; i < inFlight; i++) {
+			esc32Command_t *c = &cmds[cmdIdx[i]];
+			int r = respStatus[seqIds[i] % ESC32_SEQ_SLOTS];
+
+			if (r == ESC32_PENDING && ++sent[i] >= ESC32_TIMEOUT && tries[i] < ESC32_RETRIES) {
+				seqIds[i] = esc32SendCommand(c->command, c->param1, c->param2, c->n);
+				sent[i] = 0;
+				tries[i]++;
+			}
+			else if (r != ESC32_PENDING || sent[i] >= ESC32_TIMEOUT) {
+				c->result = r;
+				if (r == ESC32_ACK)
+					acked++;
+
+				// retire, the last slot takes its place
+				inFlight--;
+				seqIds[i] = seqIds[inFlight];
+				cmdIdx[i] = cmdIdx[inFlight];
+				sent[i] = sent[inFlight];
+				tries[i] = tries[inFlight];
+				i--;
+			}
+		}
+	}
+
+	return acked;
+}
 
-	if (lastSeqId == seqId)
-		ret = lastAck;
+int esc32SendReliably(unsigned char command, float param1, float param2, int n) {
+	esc32Command_t cmd;
+
+	cmd.command = command;
+	cmd.param1 = param1;
+	cmd.param2 = param2;
+	cmd.n = n;
 
-	return ret;
+	esc32SendPipelined(&cmd, 1);
+
+	return (cmd.result == ESC32_ACK);
 }
 
 int16_t esc32GetParamId(const char *name) {
 	unsigned short seqId;
-	int id;
 	int i, j, k;
 
 	j = 0;
 	do {
 		seqId = commandSeqId++;
+		respStatus[seqId % ESC32_SEQ_SLOTS] = ESC32_PENDING;
 
 		checkOutA = checkOutB = 0;
 		sendBufPtr = 0;
@@ -380,17 +751,245 @@ int16_t esc32GetParamId(const char *name) {
 		do {
 			usleep(1000);
 			k++;
-		} while (lastSeqId != seqId && k < 500);
+		} while (respStatus[seqId % ESC32_SEQ_SLOTS] == ESC32_PENDING && k < ESC32_TIMEOUT);
 
 		j++;
-	} while (lastSeqId != seqId && j < 5);
+	} while (respStatus[seqId % ESC32_SEQ_SLOTS] == ESC32_PENDING && j < ESC32_RETRIES);
 
-	if (lastSeqId == seqId)
-		id = paramId;
+	if (respStatus[seqId % ESC32_SEQ_SLOTS] == ESC32_ACK)
+		return respParamId[seqId % ESC32_SEQ_SLOTS];
 	else
-		id = -1;
+		return -1;
+}
+
+// read a range of parameters in one request, checked against the ESC's hash
+int esc32GetParams(int first, int count, float *values, float *version) {
+	unsigned short seqId;
+	int i, j, k, n;
+
+	for (j = 0; j < ESC32_RETRIES; j++) {
+		for (i = 0; i < count; i++)
+			paramRcvd[first + i] = 0;
+
+		paramSeqId = commandSeqId;
+		seqId = esc32SendCommand(BINARY_COMMAND_GET_PARAMS, first, count, 2);
+
+		k = 0;
+		do {
+			usleep(1000);
+			for (n = 0, i = 0; i < count; i++)
+				n += paramRcvd[first + i];
+		} while (n < count && respStatus[seqId % ESC32_SEQ_SLOTS] != ESC32_NACK && ++k < ESC32_TIMEOUT);
+
+		if (respStatus[seqId % ESC32_SEQ_SLOTS] == ESC32_NACK)
+			break;
+
+		if (n == count) {
+			for (i = 0; i < count; i++)
+				values[i] = paramValues[first + i];
+
+			if (XXH32(values, count*sizeof(float), 0) == paramHash) {
+				*version = paramVersion;
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+unsigned short esc32SendParamFrame(int first, int count, int txFirst, int txCount, float version, unsigned int hash, float *values) {
+	int i;
+
+	checkOutA = checkOutB = 0;
+	sendBufPtr = 0;
+	respStatus[commandSeqId % ESC32_SEQ_SLOTS] = ESC32_PENDING;
+
+	sendBuf[sendBufPtr++] = 'A';
+	sendBuf[sendBufPtr++] = 'q';
+	esc32SendChar(1 + 2 + 4 + 4 + 4 + count*sizeof(float));
+	esc32SendChar(BINARY_COMMAND_SET_PARAMS);
+	esc32SendShort(commandSeqId++);
+	esc32SendChar(first);
+	esc32SendChar(count);
+	esc32SendChar(txFirst);
+	esc32SendChar(txCount);
+	esc32SendFloat(version);
+	esc32SendShort(hash);
+	esc32SendShort(hash >> 16);
+	for (i = 0; i < count; i++)
+		esc32SendFloat(values[i]);
+
+	sendBuf[sendBufPtr++] = checkOutA;
+	sendBuf[sendBufPtr++] = checkOutB;
+	esc32Send();
+
+	return (commandSeqId - 1);
+}
+
+// write a range of parameters, every frame in flight at once.  The ESC
+// applies nothing unless the whole range arrives and matches the hash.
+int esc32SetParams(int first, int count, float *values, float version) {
+	unsigned short seqIds[CONFIG_NUM_PARAMS / BINARY_PARAMS_PER_FRAME + 1];
+	unsigned int hash = XXH32(values, count*sizeof(float), 0);
+	int frames, acked, nacked;
+	int i, j, k, n;
+
+	for (j = 0; j < ESC32_RETRIES; j++) {
+		frames = 0;
+		for (i = 0; i < count; i += BINARY_PARAMS_PER_FRAME) {
+			n = count - i;
+			if (n > BINARY_PARAMS_PER_FRAME)
+				n = BINARY_PARAMS_PER_FRAME;
+
+			seqIds[frames++] = esc32SendParamFrame(first + i, n, first, count, version, hash, values + i);
+		}
+
+		k = 0;
+		do {
+			usleep(1000);
+
+			acked = nacked = 0;
+			for (i = 0; i < frames; i++) {
+				if (respStatus[seqIds[i] % ESC32_SEQ_SLOTS] == ESC32_ACK)
+					acked++;
+				else if (respStatus[seqIds[i] % ESC32_SEQ_SLOTS] == ESC32_NACK)
+					nacked++;
+			}
+		} while (acked + nacked < frames && ++k < ESC32_TIMEOUT);
+
+		// rejected, resending will not help
+		if (nacked)
+			break;
+
+		if (acked == frames)
+			return 1;
+	}
+
+	return 0;
+}
+
+int esc32SaveParams(const char *fileName) {
+	float values[CONFIG_NUM_PARAMS];
+	float version;
+	FILE *fp;
+	int i;
+
+	if (!esc32GetParams(0, CONFIG_NUM_PARAMS, values, &version))
+		return 0;
+
+	if ((fp = fopen(fileName, "w")) == NULL)
+		return 0;
+
+	for (i = 0; i < CONFIG_NUM_PARAMS; i++)
+		fprintf(fp, "%d\t%.9g\n", i, values[i]);
+
+	fclose(fp);
+
+	return 1;
+}
+
+// ids missing from the file keep their current values
+int esc32LoadParams(const char *fileName) {
+	float values[CONFIG_NUM_PARAMS];
+	float version;
+	float f;
+	FILE *fp;
+	int i;
+
+	if (!esc32GetParams(0, CONFIG_NUM_PARAMS, values, &version))
+		return 0;
+
+	if ((fp = fopen(fileName, "r")) == NULL)
+		return 0;
+
+	while (fscanf(fp, "%d %f", &i, &f) == 2)
+		if (i > CONFIG_VERSION && i < CONFIG_NUM_PARAMS)
+			values[i] = f;
+
+	fclose(fp);
+
+	if (!esc32SetParams(0, CONFIG_NUM_PARAMS, values, version))
+		return 0;
+
+	// write to flash
+	return esc32SendReliably(BINARY_COMMAND_CONFIG, 1.0, 0.0, 1);
+}
 
-	return id;
+// aggregate a signal on-board, summaries arrive in telemStats[]
+int esc32SetStats(int slot, int value, float lo, float hi) {
+	float params[4] = {(float)slot, (float)value, lo, hi};
+
+	return esc32SendReliablyN(BINARY_COMMAND_TELEM_STATS, params, 4);
+}
+
+int esc32CaptureArm(int trigger, int preRows, float level) {
+	float params[3] = {(float)trigger, (float)preRows, level};
+
+	return esc32SendReliablyN(BINARY_COMMAND_CAPTURE_ARM, params, 3);
+}
+
+// wait for a capture to trigger and stream out, asking again for any
+// rows lost on the way.  Returns the number of rows or 0.
+int esc32CaptureWait(int timeoutMs) {
+	int last = -1;
+	int quiet = 0;
+	int first, i, k;
+
+	for (k = 0; k < timeoutMs; k++) {
+		usleep(1000);
+
+		if (captureRows && captureRcvdNum == captureRows)
+			return captureRows;
+
+		if (captureRcvdNum != last) {
+			last = captureRcvdNum;
+			quiet = 0;
+		}
+		// the stream has stopped short, request the gaps
+		else if (captureRows && ++quiet == 50) {
+			for (i = 0; i < captureRows; i++) {
+				if (captureRcvd[i])
+					continue;
+
+				for (first = i; i < captureRows && !captureRcvd[i]; i++)
+					;
+
+				esc32SendReliably(BINARY_COMMAND_CAPTURE_READ, first, i - first, 2);
+			}
+			quiet = 0;
+		}
+	}
+
+	return 0;
+}
+
+// one frame each way instead of a telemetry stream
+int esc32GetStatus(binaryStatus_t *status) {
+	if (!esc32SendReliably(BINARY_COMMAND_STATUS, 0.0, 0.0, 0))
+		return 0;
+
+	memcpy(status, &statusReply, sizeof(statusReply));
+
+	return 1;
+}
+
+int esc32GetVersion(binaryVersion_t *ver) {
+	if (!esc32SendReliably(BINARY_COMMAND_VERSION, 0.0, 0.0, 0))
+		return 0;
+
+	memcpy(ver, &versionReply, sizeof(versionReply));
+
+	return 1;
+}
+
+int esc32SetTelemValue(int col, int value) {
+	if (!esc32SendReliably(BINARY_COMMAND_TELEM_VALUE, col, value, 2))
+		return 0;
+
+	telemColValues[col] = value;
+
+	return 1;
 }
 
 short esc32SetParamByName(const char *name, float value) {
@@ -532,10 +1131,49 @@ void rpmToVoltage(void) {
 	rpmToVoltageGraph(data, ab, j);
 }
 
+// the step response at the full run rate, loss free
+void stepUpCapture(float end) {
+	int rows, cols;
+	int i, j, n;
+
+	captureRows = 0;
+	captureRcvdNum = 0;
+
+	if (!esc32CaptureArm(BINARY_CAPTURE_SETPOINT, 32, 0.0)) {
+		fprintf(stderr, "esc32Cal: cannot arm capture\n");
+		return;
+	}
+
+	esc32SendReliably(BINARY_COMMAND_DUTY, end, 0.0, 1);
+
+	if (!(rows = esc32CaptureWait(5000))) {
+		fprintf(stderr, "esc32Cal: capture failed\n");
+		return;
+	}
+	cols = captureCols;
+
+	// same path as streamed telemetry
+	for (i = 0; i < rows; i += n) {
+		n = rows - i;
+		if (n > 256)
+			n = 256;
+
+		for (j = 0; j < n * cols; j++)
+			telemData[j / cols][j % cols] = captureData[i*cols + j] / telemScale[captureValues[j % cols]];
+
+		esc32TelemRows(n, cols);
+	}
+}
+
 void stepUp(float start, float end) {
         esc32SendReliably(BINARY_COMMAND_DUTY, start, 0.0, 1);
         sleep(2);
 
+	if (runCapture) {
+		stepUpCapture(end);
+		return;
+	}
+
         esc32SendReliably(BINARY_COMMAND_TELEM_RATE, 1000.0, 0.0, 1);
         esc32SendReliably(BINARY_COMMAND_DUTY, end, 0.0, 1);
         usleep(200000);
@@ -716,12 +1354,59 @@ int main(int argc, char **argv) {
 		return 0;
 	}
 
-	esc32SendReliably(BINARY_COMMAND_ARM, 0.0, 0.0, 0);
-	esc32SendReliably(BINARY_COMMAND_STOP, 0.0, 0.0, 0);
-	esc32SendReliably(BINARY_COMMAND_TELEM_RATE, 0.0, 0.0, 1);
-	esc32SendReliably(BINARY_COMMAND_TELEM_VALUE, 0.0, BINARY_VALUE_RPM, 2);
-	esc32SendReliably(BINARY_COMMAND_TELEM_VALUE, 1.0, BINARY_VALUE_VOLTS_MOTOR, 2);
-	esc32SendReliably(BINARY_COMMAND_TELEM_VALUE, 2.0, BINARY_VALUE_AMPS, 2);
+	{
+		binaryVersion_t ver;
+
+		if (esc32GetVersion(&ver))
+			printf("ESC32 ver %.16s, config ver %.2f\n", ver.version, ver.configVersion);
+	}
+
+	if (paramLoadFile && !esc32LoadParams(paramLoadFile))
+		fprintf(stderr, "esc32Cal: cannot load parameters from '%s'\n", paramLoadFile);
+
+	if (paramSaveFile && !esc32SaveParams(paramSaveFile))
+		fprintf(stderr, "esc32Cal: cannot save parameters to '%s'\n", paramSaveFile);
+
+	if (!runR2V && !runCL) {
+		esc32SendCommand(BINARY_COMMAND_CLI, 0.0, 0.0, 0);
+		return 1;
+	}
+
+	{
+		esc32Command_t setup[] = {
+			{ BINARY_COMMAND_ARM, 0.0, 0.0, 0 },
+			{ BINARY_COMMAND_STOP, 0.0, 0.0, 0 },
+			{ BINARY_COMMAND_TELEM_RATE, 0.0, 0.0, 1 },
+			{ BINARY_COMMAND_TELEM_VALUE, 0, BINARY_VALUE_RPM, 2 },
+			{ BINARY_COMMAND_TELEM_VALUE, 1, BINARY_VALUE_VOLTS_MOTOR, 2 },
+			{ BINARY_COMMAND_TELEM_VALUE, 2, BINARY_VALUE_AMPS, 2 }
+		};
+		int n = sizeof(setup) / sizeof(setup[0]);
+
+		// all in flight at once
+		esc32SendPipelined(setup, n);
+
+		for (i = 0; i < n; i++)
+			if (setup[i].command == BINARY_COMMAND_TELEM_VALUE && setup[i].result == ESC32_ACK)
+				telemColValues[(int)setup[i].param1] = setup[i].param2;
+	}
+
+	// step responses captured on-board in the telemetry column order
+	if (runCapture) {
+		esc32Command_t capture[] = {
+			{ BINARY_COMMAND_CAPTURE_VALUE, 0, BINARY_VALUE_RPM, 2 },
+			{ BINARY_COMMAND_CAPTURE_VALUE, 1, BINARY_VALUE_VOLTS_MOTOR, 2 },
+			{ BINARY_COMMAND_CAPTURE_VALUE, 2, BINARY_VALUE_AMPS, 2 }
+		};
+
+		if (esc32SendPipelined(capture, 3) != 3) {
+			fprintf(stderr, "esc32Cal: burst capture not supported, streaming\n");
+			runCapture = 0;
+		}
+	}
+
+	if (telemFixed && !esc32SendReliably(BINARY_COMMAND_TELEM_FORMAT, BINARY_TELEM_FIXED, telemDelta, 2))
+		fprintf(stderr, "esc32Cal: fixed point telemetry not supported, using floats\n");
 //	esc32SendReliably(BINARY_COMMAND_SET, MAX_CURRENT, 0.0, 2);
 	esc32SetParamByName("MAX_CURRENT", 0.0);
 
@@ -56,6 +56,7 @@ uint8_t adcStateA, adcStateB, adcStateC;
 volatile uint32_t detectedCrossing;
 volatile uint32_t crossingPeriod;
 volatile int32_t adcCrossingPeriod;
+volatile int32_t adcBemfSpread;
 uint32_t nextCrossingDetect;
 uint32_t numLoops;
 
@@ -114,6 +115,7 @@ void adcInit(void) {
     NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
     NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
     NVIC_Init(&NVIC_InitStructure);
+    NVIC_SetPriority(DMA1_Channel1_IRQn, FET_DITHER_IRQ_PRIORITY+1);	// commutation may preempt, nothing else may
 
     // ADC1 configuration
 //    ADC_InitStructure.ADC_Mode = ADC_Mode_RegSimult;
@@ -254,9 +256,7 @@ void DMA1_Channel1_IRQHandler(void) {
     int ampsFlag = 0;
     uint32_t currentMicros;
 
-    __asm volatile ("cpsid i");
     currentMicros = timerGetMicros();
-    __asm volatile ("cpsie i");
 
 #ifdef ADC_FAST_SAMPLE
     if ((DMA1->ISR & DMA1_FLAG_TC1) != RESET) {
@@ -298,7 +298,7 @@ void DMA1_Channel1_IRQHandler(void) {
 	avgB += valB - histB[histIndex];
 	avgC += valC - histC[histIndex];
 
-	if ((avgA+avgB+avgC)/histSize > (ADC_MIN_COMP*3) && state != ESC_STATE_DISARMED) {
+	if ((avgA+avgB+avgC)/histSize > (ADC_MIN_COMP*3) && state != ESC_STATE_DISARMED && !fetBeeping) {
 	    register int32_t periodMicros;
 
 	    periodMicros = (currentMicros >= detectedCrossing) ? (currentMicros - detectedCrossing) : (TIMER_MASK - detectedCrossing + currentMicros);
@@ -350,6 +350,8 @@ void DMA1_Channel1_IRQHandler(void) {
 		}
 
 		if (nextStep && periodMicros > adcMinPeriod) {
+		    register int32_t commDelay;
+
 		    if (periodMicros > adcMaxPeriod)
 			periodMicros = adcMaxPeriod;
 
@@ -362,10 +364,14 @@ void DMA1_Channel1_IRQHandler(void) {
 //		    crossingPeriod = (crossingPeriod*7 + periodMicros)/8;
 //		    crossingPeriod = (crossingPeriod*15 + periodMicros)/16;
 
-		    // schedule next commutation
+		    // schedule next commutation - always via the TIMER_ISR, which preempts us
+		    timerCancelAlarm1();
 		    fetStep = nextStep;
 		    fetCommutationMicros = 0;
-		    timerSetAlarm1(crossingPeriod/2 - (ADC_DETECTION_TIME*(histSize+2))/2 - ADC_COMMUTATION_ADVANCE, fetCommutate, crossingPeriod);
+		    commDelay = crossingPeriod/2 - (ADC_DETECTION_TIME*(histSize+2))/2 - ADC_COMMUTATION_ADVANCE;
+		    if (commDelay <= TIMER_MULT)
+			commDelay = TIMER_MULT + 1;
+		    timerSetAlarm1(commDelay, fetCommutate, crossingPeriod);
 
 		    // record crossing time
 		    detectedCrossing = currentMicros;
@@ -381,6 +387,16 @@ void DMA1_Channel1_IRQHandler(void) {
 		    // record highest current draw for this run
 		    if (adcAvgAmps > adcMaxAmps)
 			adcMaxAmps = adcAvgAmps;
+
+		    // with one phase crossing, the other two sit near the line to line
+		    // BEMF peak - used to match duty when catching a spinning rotor
+		    if (state == ESC_STATE_NOCOMM) {
+			valA = (avgA > avgB) ? avgA : avgB;
+			valA = (avgC > valA) ? avgC : valA;
+			valB = (avgA < avgB) ? avgA : avgB;
+			valB = (avgC < valB) ? avgC : valB;
+			adcBemfSpread = (valA - valB) / histSize;
+		    }
 		}
 	    }
 	}
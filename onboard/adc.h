@@ -27,9 +27,11 @@
 #ifdef ADC_FAST_SAMPLE
     #define ADC_SAMPLE_TIME	ADC_SampleTime_7Cycles5
     #define ADC_DETECTION_TIME	(uint16_t)((7.5+12.5)*4*TIMER_MULT/12)	    // 4 ADC groups w/7.5 clk sample @ 12Mhz ADC clock (in us)
+    #define ADC_HIST_SAMPLES	2					    // conversions summed per history entry
 #else
     #define ADC_SAMPLE_TIME	ADC_SampleTime_28Cycles5
     #define ADC_DETECTION_TIME	(uint16_t)((28.5+12.5)*2*TIMER_MULT/12)	    // 2 ADC groups w/28.5 clk sample @ 12Mhz ADC clock (in us)
+    #define ADC_HIST_SAMPLES	1					    // conversions summed per history entry
 #endif	// ADC_FAST_SAMPLE
 
 #define ADC_CHANNELS            2
@@ -85,6 +87,7 @@ extern uint32_t avgA, avgB, avgC;
 extern volatile uint32_t detectedCrossing;
 extern volatile uint32_t crossingPeriod;
 extern volatile int32_t adcCrossingPeriod;
+extern volatile int32_t adcBemfSpread;
 
 extern void adcInit(void);
 extern void adcSetConstants(void);
@@ -22,19 +22,97 @@
 #include "fet.h"
 #include "adc.h"
 #include "config.h"
+#include "timer.h"
+#include "pwm.h"
+#include "cli.h"
+#include "xxhash.h"
+#include <string.h>
+#include <math.h>
 
 binaryCommandStruct_t commandBuf;
 uint32_t binaryLoop;
-uint16_t sendAck, sendNack, sendParamId;
-int16_t paramId;
-uint32_t binaryTelemRate;
-uint8_t binaryTelemetryStop;
+binaryResponse_t binaryResponses[BINARY_RESPONSE_QUEUE];
+volatile uint8_t binaryRespHead;    // written by the parser only
+volatile uint8_t binaryRespTail;    // written by the main loop only
+float binaryParamStage[CONFIG_NUM_PARAMS];	// bulk write being received
+uint8_t binaryParamRcvd[CONFIG_NUM_PARAMS];
+uint8_t binaryParamTxFirst, binaryParamTxCount, binaryParamTxLeft;
+uint32_t binaryParamTxHash;
+volatile uint32_t binaryTelemRate;
+volatile uint8_t binaryTelemetryStop;
+volatile uint8_t binaryTelemReset;	    // parser asks the main loop to drop the open frame
+volatile uint8_t binaryCliReq;		    // parser asks the main loop to switch to the CLI
 uint8_t binaryTelemRows;
 uint8_t binaryTelemCols;
 uint8_t outChkA, outChkB;
 uint8_t inChkA, inChkB;
 uint8_t binaryParseState;
 uint8_t binaryTelemValues[BINARY_VALUE_NUM];
+uint8_t binaryTelemFormat = BINARY_TELEM_FLOAT;
+uint8_t binaryTelemDelta;
+uint16_t binaryTelemSeq;
+int32_t binaryTelemLast[BINARY_VALUE_NUM];
+uint8_t binaryTelemDiv[BINARY_VALUE_NUM];   // column sent every n rows, 0 is every row
+uint16_t binaryTelemSample;		    // row counter, sets the phase of the dividers
+uint8_t binaryTelemRow;
+uint8_t binaryFrameRows, binaryFrameCols;   // geometry of the open frame
+uint8_t binaryFrameFormat, binaryFrameDelta;
+uint8_t binaryFrameDiv[BINARY_VALUE_NUM];
+uint32_t binaryFrameSent;		    // columns already in the open frame
+uint8_t *binaryFrame;	    // telemetry frame being built in place in the serial tx buffer
+uint8_t *binaryOut;
+binaryStats_t binaryStats[BINARY_STATS_NUM];	    // window being accumulated
+binaryStats_t binaryStatsOut[BINARY_STATS_NUM];	    // last full window, waiting to be sent
+uint8_t binaryStatsValue[BINARY_STATS_NUM];	    // as set by the host
+float binaryStatsLo[BINARY_STATS_NUM], binaryStatsHi[BINARY_STATS_NUM];
+volatile uint16_t binaryStatsWindow;		    // run loops per summary, 0 is off
+volatile uint8_t binaryStatsReset;		    // parser asks for a new window
+uint16_t binaryStatsSamples, binaryStatsOutSamples;
+uint8_t binaryStatsPending;
+uint16_t binaryStatsSeq;
+int16_t binaryCaptureBuf[BINARY_CAPTURE_SIZE];	    // ring of rows, scaled like fixed point telemetry
+uint8_t binaryCaptureValues[BINARY_CAPTURE_COLS];
+uint8_t binaryCaptureCols;
+uint16_t binaryCaptureRows;			    // ring size for the columns chosen
+uint8_t binaryCaptureTrig;
+uint16_t binaryCapturePre;			    // rows wanted before the trigger
+float binaryCaptureLevel;
+volatile uint8_t binaryCaptureState;
+volatile uint8_t binaryCaptureFire;
+uint16_t binaryCapturePos, binaryCaptureFilled, binaryCaptureLeft;
+uint16_t binaryCaptureStart;			    // ring index of the oldest row
+uint16_t binaryCaptureTrigRow;			    // rows before the trigger
+uint16_t binaryCaptureSeq;
+volatile uint16_t binaryCaptureReqFirst, binaryCaptureReqEnd;
+volatile uint8_t binaryCaptureReq;
+uint16_t binaryCaptureSendPos, binaryCaptureSendEnd;
+uint32_t binaryCmdLatency;	    // us from rx wakeup to command action
+uint32_t binaryCmdMaxLatency;
+
+// fixed point telemetry - counts per natural unit, must match the ground side
+const float binaryTelemScale[BINARY_VALUE_NUM] = {
+    1.0f,	    // NONE
+    100.0f,	    // AMPS		    0.01 A
+    100.0f,	    // VOLTS_BAT	    0.01 V
+    100.0f,	    // VOLTS_MOTOR	    0.01 V
+    1.0f,	    // RPM
+    10000.0f,	    // DUTY		    0.01 %
+    1.0f,	    // COMM_PERIOD	    us
+    1.0f,	    // BAD_DETECTS
+    1.0f,	    // ADC_WINDOW
+    100.0f,	    // IDLE_PERCENT	    0.01 %
+    1.0f,	    // STATE
+    0.0625f,	    // AVGA		    16 counts
+    0.0625f,	    // AVGB
+    0.0625f,	    // AVGC
+    0.0625f,	    // AVGCOMP
+    1.0f,	    // FETSTEP
+    0.001f,	    // START_TIME	    ms
+    0.001f,	    // FIRST_DETECT_TIME    ms
+    1.0f,	    // FAILED_STARTS
+    0.001f,	    // REVERSE_TIME	    ms
+    1.0f	    // CMD_LATENCY	    us
+};
 
 uint8_t binaryGetChar(uint8_t checkSum) {
     uint8_t c;
@@ -55,96 +133,353 @@ void binarySendChar(int ch) {
     outChkB += outChkA;
 }
 
-void binarySendFloat(float f) {
+void binarySendShort(uint16_t i) {
     uint8_t j;
-    uint8_t *c = (uint8_t *)&f;
+    uint8_t *c = (uint8_t *)&i;
 
-    for (j = 0; j < sizeof(float); j++)
+    for (j = 0; j < sizeof(uint16_t); j++)
 	binarySendChar(*c++);
 }
 
-void binarySendShort(uint16_t i) {
-    uint8_t j;
-    uint8_t *c = (uint8_t *)&i;
+static inline void binaryPutShort(uint16_t i) {
+    *binaryOut++ = i;
+    *binaryOut++ = i>>8;
+}
 
-    for (j = 0; j < sizeof(uint16_t); j++)
+static inline void binaryPutFloat(float f) {
+    uint8_t *c = (uint8_t *)&f;
+
+    *binaryOut++ = *c++;
+    *binaryOut++ = *c++;
+    *binaryOut++ = *c++;
+    *binaryOut++ = *c++;
+}
+
+// bulk parameter read, one "AqP" frame per BINARY_PARAMS_PER_FRAME values,
+// all reserved and committed together.  Returns 0 if there is no room yet.
+static int binarySendParams(binaryResponse_t *r) {
+    uint32_t hash = XXH32(&p[r->value], r->count * sizeof(float), 0);
+    uint8_t *start, *frame;
+    int first, count;
+    int frames;
+    int i;
+
+    frames = (r->count + BINARY_PARAMS_PER_FRAME - 1) / BINARY_PARAMS_PER_FRAME;
+
+    binaryOut = start = serialReserve(frames * (3 + 2 + 14 + 2) + r->count * sizeof(float));
+    if (!start)
+	return 0;
+
+    for (first = r->value; first < r->value + r->count; first += count) {
+	count = r->value + r->count - first;
+	if (count > BINARY_PARAMS_PER_FRAME)
+	    count = BINARY_PARAMS_PER_FRAME;
+
+	frame = binaryOut;
+	*binaryOut++ = 'A';
+	*binaryOut++ = 'q';
+	*binaryOut++ = 'P';
+	binaryPutShort(14 + count * sizeof(float));
+	binaryPutShort(r->seqId);
+	*binaryOut++ = first;
+	*binaryOut++ = count;
+	*binaryOut++ = r->value;
+	*binaryOut++ = r->count;
+	binaryPutFloat(p[CONFIG_VERSION]);
+	binaryPutShort(hash);
+	binaryPutShort(hash >> 16);
+
+	for (i = first; i < first + count; i++)
+	    binaryPutFloat(p[i]);
+
+	// CRC16 over length and payload
+	binaryPutShort(serialCrc16(frame + 3, binaryOut - frame - 3, 0xffff));
+    }
+
+    serialCommit(binaryOut - start);
+
+    return 1;
+}
+
+static void binarySendBytes(void *buf, int len) {
+    uint8_t *c = (uint8_t *)buf;
+
+    while (len--)
 	binarySendChar(*c++);
 }
 
+static void binaryStatusSnapshot(binaryStatus_t *s) {
+    uint32_t badDetects;
+    int32_t duty;
+
+    __asm volatile ("cpsid i");
+    s->state = state;
+    s->runMode = runMode;
+    s->inputMode = inputMode;
+    s->disarmReason = disarmReason;
+    s->rpm = rpm;
+    s->amps = avgAmps;
+    s->volts = avgVolts;
+    s->idlePercent = idlePercent;
+    duty = fetActualDutyCycle;
+    badDetects = fetTotalBadDetects;
+    __asm volatile ("cpsie i");
+
+    s->micros = timerGetMicros() / TIMER_MULT;
+    s->duty = (float)duty * 100.0f / FET_DUTY_PERIOD;
+    s->badDetects = badDetects;
+}
+
+// main loop only, the parser may post new responses at any time
 void binaryProcessResponses(void) {
-    while (sendAck || sendNack || sendParamId) {
-	serialPrint("AqC");
-	outChkA = outChkB = 0;
+    binaryResponse_t *r;
 
-	if (sendAck) {
-            // ACK + checksum chars
-            binarySendChar(1 + 2);
+    while (binaryRespTail != binaryRespHead) {
+	r = &binaryResponses[binaryRespTail];
 
-	    binarySendChar(BINARY_COMMAND_ACK);
-	    binarySendShort(sendAck);
-	    sendAck = 0;
+	if (r->command == BINARY_COMMAND_GET_PARAMS) {
+	    // retried on a later pass if the tx buffer is full
+	    if (!binarySendParams(r))
+		break;
 	}
-	else if (sendNack) {
-            // NACK + checksum chars
-            binarySendChar(1 + 2);
+	else {
+	    serialPrint("AqC");
+	    outChkA = outChkB = 0;
 
-	    binarySendChar(BINARY_COMMAND_NACK);
-	    binarySendShort(sendNack);
-	    sendNack = 0;
-	}
-        else if (sendParamId) {
-            // command + paramId + checksum chars
-            binarySendChar(1 + 2 + 2);
+	    if (r->command == BINARY_COMMAND_GET_PARAM_ID) {
+		// command + paramId + checksum chars
+		binarySendChar(1 + 2 + 2);
 
-            binarySendChar(BINARY_COMMAND_GET_PARAM_ID);
-            binarySendShort(sendParamId);
-            binarySendShort(paramId);
-            sendParamId = 0;
-        }
+		binarySendChar(r->command);
+		binarySendShort(r->seqId);
+		binarySendShort(r->value);
+	    }
+	    else if (r->command == BINARY_COMMAND_STATUS) {
+		binaryStatus_t status;
+
+		binaryStatusSnapshot(&status);
+
+		binarySendChar(1 + 2 + sizeof(status));
+
+		binarySendChar(r->command);
+		binarySendShort(r->seqId);
+		binarySendBytes(&status, sizeof(status));
+	    }
+	    else if (r->command == BINARY_COMMAND_VERSION) {
+		binaryVersion_t ver;
 
-	serialWrite(outChkA);
-	serialWrite(outChkB);
+		strncpy(ver.version, version, sizeof(ver.version));
+		ver.configVersion = p[CONFIG_VERSION];
+
+		binarySendChar(1 + 2 + sizeof(ver));
+
+		binarySendChar(r->command);
+		binarySendShort(r->seqId);
+		binarySendBytes(&ver, sizeof(ver));
+	    }
+	    else {
+		// (N)ACK + checksum chars
+		binarySendChar(1 + 2);
+
+		binarySendChar(r->command);
+		binarySendShort(r->seqId);
+	    }
+
+	    serialWrite(outChkA);
+	    serialWrite(outChkB);
+	}
+
+	binaryRespTail = (binaryRespTail + 1) % BINARY_RESPONSE_QUEUE;
     }
 }
 
-void binaryTelemSend(void) {
-    uint8_t *c;
+// reserve room for a whole telemetry frame and write its header
+static void binaryTelemOpen(void) {
+    uint32_t t;
+    int len;
     int i;
 
-    serialWrite(outChkA);
-    serialWrite(outChkB);
+    // the parser may change these while the frame is being built
+    binaryFrameRows = binaryTelemRows;
+    binaryFrameCols = binaryTelemCols;
+    binaryFrameFormat = binaryTelemFormat;
+    binaryFrameDelta = binaryTelemDelta;
+    binaryFrameSent = 0;
+    for (i = 0; i < binaryFrameCols; i++)
+	binaryFrameDiv[i] = binaryTelemDiv[i] ? binaryTelemDiv[i] : 1;
+
+    // room for every column in every row
+    if (binaryFrameFormat == BINARY_TELEM_FIXED)
+	len = 3 + 2 + 11 + binaryFrameCols + binaryFrameRows * binaryFrameCols * (binaryFrameDelta ? 3 : 2) + 2;
+    else
+	len = 3 + 2 + binaryFrameRows * binaryFrameCols * sizeof(float) + 2;
+
+    binaryOut = binaryFrame = serialReserve(len);
+
+    if (binaryFrameFormat == BINARY_TELEM_FIXED) {
+	// frame counter advances even if there is no room, the gap shows
+	if (binaryFrame) {
+	    t = timerGetMicros() / TIMER_MULT;
+
+	    *binaryOut++ = 'A';
+	    *binaryOut++ = 'q';
+	    *binaryOut++ = 'V';
+	    binaryOut += 2;			    // length, filled on close
+	    *binaryOut++ = binaryFrameRows;
+	    *binaryOut++ = binaryFrameCols;
+	    *binaryOut++ = binaryFrameDelta;
+	    binaryPutShort(binaryTelemSeq);
+	    binaryPutShort(t);
+	    binaryPutShort(t >> 16);
+
+	    // layout, column i is in the rows where (sample + row) % div[i] == 0
+	    binaryPutShort(binaryTelemSample);
+	    for (i = 0; i < binaryFrameCols; i++)
+		*binaryOut++ = binaryFrameDiv[i];
+	}
+	binaryTelemSeq++;
+    }
+    else if (binaryFrame) {
+	*binaryOut++ = 'A';
+	*binaryOut++ = 'q';
+	*binaryOut++ = 'T';
+	*binaryOut++ = binaryFrameRows;
+	*binaryOut++ = binaryFrameCols;
+    }
+}
 
-    // process any (N)Acks between telemetry packets
-    binaryProcessResponses();
+// checksum and hand the frame to the serial DMA
+static void binaryTelemClose(void) {
+    uint8_t *c;
+    uint16_t crc;
+    int len;
 
-    if (!binaryTelemetryStop) {
-	serialPrint("AqT");
+    if (!binaryFrame)
+	return;
 
-	outChkA = outChkB = 0;
+    if (binaryFrameFormat == BINARY_TELEM_FIXED) {
+	// length delimited, CRC16 over length and payload
+	len = binaryOut - binaryFrame - 5;
+	binaryFrame[3] = len;
+	binaryFrame[4] = len>>8;
 
-	binarySendChar(binaryTelemRows);    // rows
-	binarySendChar(binaryTelemCols);    // cols
+	crc = serialCrc16(binaryFrame + 3, len + 2, 0xffff);
+	binaryPutShort(crc);
     }
     else {
+	outChkA = outChkB = 0;
+	for (c = binaryFrame + 3; c < binaryOut; c++) {
+	    outChkA += *c;
+	    outChkB += outChkA;
+	}
+	*binaryOut++ = outChkA;
+	*binaryOut++ = outChkB;
+    }
+
+    serialCommit(binaryOut - binaryFrame);
+    binaryFrame = 0;
+}
+
+// drop a partly built frame, nothing has been sent
+static void binaryTelemAbort(void) {
+    binaryTelemReset = 1;
+}
+
+void binaryTelemSend(void) {
+    binaryTelemClose();
+
+    // process any (N)Acks between telemetry packets
+    binaryProcessResponses();
+
+    if (binaryTelemetryStop) {
 	binaryTelemRate = 0;
 	binaryTelemetryStop = 0;
     }
 }
 
-//  TODO: yet to be implemented:
-//    BINARY_COMMAND_PWM,
-//    BINARY_COMMAND_STATUS,
-//    BINARY_COMMAND_VERSION
+// queue a response to the current command, dropped if the host has
+// more commands in flight than the queue holds - it will retry
+static void binaryRespond(uint8_t command, int16_t value, uint8_t count) {
+    uint8_t head = (binaryRespHead + 1) % BINARY_RESPONSE_QUEUE;
+    binaryResponse_t *r;
+
+    if (head == binaryRespTail)
+	return;
+
+    r = &binaryResponses[binaryRespHead];
+    r->command = command;
+    r->seqId = commandBuf.seqId;
+    r->value = value;
+    r->count = count;
+
+    binaryRespHead = head;
+}
 
 void binaryAck(void) {
-    sendAck = commandBuf.seqId;
+    binaryRespond(BINARY_COMMAND_ACK, 0, 0);
 }
 
 void binaryNack(void) {
-    sendNack = commandBuf.seqId;
+    binaryRespond(BINARY_COMMAND_NACK, 0, 0);
+}
+
+// stage one frame of a bulk write, the values are applied together
+// once the whole range has arrived and its hash matches
+static int binarySetParams(binaryParams_t *b) {
+    int i;
+
+    if (b->version != p[CONFIG_VERSION] || b->count == 0 || b->count > BINARY_PARAMS_PER_FRAME ||
+	b->txCount == 0 || b->txFirst + b->txCount > CONFIG_NUM_PARAMS ||
+	b->first < b->txFirst || b->first + b->count > b->txFirst + b->txCount)
+	return 0;
+
+    // a new transfer
+    if (b->txFirst != binaryParamTxFirst || b->txCount != binaryParamTxCount || b->hash != binaryParamTxHash) {
+	binaryParamTxFirst = b->txFirst;
+	binaryParamTxCount = b->txCount;
+	binaryParamTxHash = b->hash;
+	binaryParamTxLeft = b->txCount;
+
+	for (i = 0; i < CONFIG_NUM_PARAMS; i++)
+	    binaryParamRcvd[i] = 0;
+    }
+
+    // resent frames are harmless
+    for (i = 0; i < b->count; i++) {
+	if (!binaryParamRcvd[b->first + i]) {
+	    binaryParamRcvd[b->first + i] = 1;
+	    binaryParamTxLeft--;
+	}
+	binaryParamStage[b->first + i] = b->values[i];
+    }
+
+    if (binaryParamTxLeft)
+	return 1;
+
+    // complete, the next frame starts over
+    binaryParamTxCount = 0;
+
+    if (XXH32(binaryParamStage + b->txFirst, b->txCount * sizeof(float), 0) != b->hash)
+	return 0;
+
+    for (i = b->txFirst; i < b->txFirst + b->txCount; i++)
+	if (i != CONFIG_VERSION)
+	    p[i] = binaryParamStage[i];
+
+    configRecalcConst();
+
+    return 1;
 }
 
 void binaryCommandParse(void) {
+    // a wakeup may land between the two reads, never report that as a wrap
+    uint32_t rxMicros = serialRxMicros;
+    int32_t latency = (int32_t)(timerGetMicros() - rxMicros);
+
+    binaryCmdLatency = (latency > 0) ? latency / TIMER_MULT : 0;
+    if (binaryCmdLatency > binaryCmdMaxLatency)
+	binaryCmdMaxLatency = binaryCmdLatency;
+
     switch (commandBuf.command) {
 
     case BINARY_COMMAND_NOP:
@@ -167,8 +502,10 @@ void binaryCommandParse(void) {
 	    binaryNack();
 	}
 	else {
+	    // switched by the main loop once the ack is out
 	    binaryTelemRate = 0;
-	    commandMode = CLI_MODE;
+	    binaryTelemAbort();
+	    binaryCliReq = 1;
 	    binaryAck();
 	}
 	break;
@@ -194,12 +531,38 @@ void binaryCommandParse(void) {
 	break;
 
     case BINARY_COMMAND_DUTY:
+	binaryCaptureTrigger(BINARY_CAPTURE_SETPOINT);
 	if (runDuty(commandBuf.params[0]))
 	    binaryAck();
 	else
 	    binaryNack();
 	break;
 
+    // a pulse width in us, treated like the PWM input
+    case BINARY_COMMAND_PWM:
+	{
+	    int32_t pwm = commandBuf.params[0];
+
+	    if (state >= ESC_STATE_STOPPED && inputMode == ESC_INPUT_UART && pwm >= pwmMinValue && pwm <= pwmMaxValue) {
+		binaryCaptureTrigger(BINARY_CAPTURE_SETPOINT);
+		runNewInput(pwm);
+		binaryAck();
+	    }
+	    else {
+		binaryNack();
+	    }
+	}
+	break;
+
+    case BINARY_COMMAND_STATUS:
+	// the snapshot is taken as the reply is sent
+	binaryRespond(BINARY_COMMAND_STATUS, 0, 0);
+	break;
+
+    case BINARY_COMMAND_VERSION:
+	binaryRespond(BINARY_COMMAND_VERSION, 0, 0);
+	break;
+
     case BINARY_COMMAND_RPM:
 	if (p[FF1TERM] != 0.0f) {
 	    float rpm = commandBuf.params[0];
@@ -213,6 +576,7 @@ void binaryCommandParse(void) {
 		runRpmPIDReset();
 		runMode = CLOSED_LOOP_RPM;
 	    }
+	    binaryCaptureTrigger(BINARY_CAPTURE_SETPOINT);
 	    targetRpm = rpm;
 
 	    binaryAck();
@@ -227,9 +591,12 @@ void binaryCommandParse(void) {
 	    int32_t freq = (int32_t)commandBuf.params[0];
 
 	    if (freq >= 1.0f) {
-		if (freq > 1000)
-		    freq = 1000;
+		if (binaryTelemFormat == BINARY_TELEM_FLOAT && freq > BINARY_TELEM_MAX_FLOAT_RATE)
+		    freq = BINARY_TELEM_MAX_FLOAT_RATE;
+		else if (freq > RUN_FREQ)
+		    freq = RUN_FREQ;
 
+		binaryTelemAbort();
 		binaryTelemRate = RUN_FREQ / freq;
 		binaryTelemRows = (freq <= 100) ? 1 : (freq / 50);
 		binaryTelemetryStop = 0;
@@ -252,6 +619,7 @@ void binaryCommandParse(void) {
 	if (commandBuf.params[0] < BINARY_VALUE_NUM && commandBuf.params[1] < BINARY_VALUE_NUM) {
 	    int i;
 
+	    binaryTelemAbort();
 	    binaryTelemValues[(int)commandBuf.params[0]] = commandBuf.params[1];
 
 	    binaryTelemCols = 0;
@@ -269,6 +637,143 @@ void binaryCommandParse(void) {
 	}
 	break;
 
+    // slow columns need not be in every row of fixed point telemetry
+    case BINARY_COMMAND_TELEM_DIVIDER:
+	if (commandBuf.params[0] >= 0.0f && commandBuf.params[0] < BINARY_VALUE_NUM && commandBuf.params[1] >= 1.0f && commandBuf.params[1] <= 255.0f) {
+	    binaryTelemDiv[(int)commandBuf.params[0]] = commandBuf.params[1];
+	    binaryAck();
+	}
+	else {
+	    binaryNack();
+	}
+	break;
+
+    // min, max, mean, RMS and a histogram of a signal, see binaryStatsSample()
+    case BINARY_COMMAND_TELEM_STATS:
+	if (commandBuf.params[0] >= 0.0f && commandBuf.params[0] < BINARY_STATS_NUM && commandBuf.params[1] >= 0.0f && commandBuf.params[1] < BINARY_VALUE_NUM &&
+		(commandBuf.params[1] == BINARY_VALUE_NONE || commandBuf.params[3] > commandBuf.params[2])) {
+	    int i = commandBuf.params[0];
+
+	    binaryStatsValue[i] = commandBuf.params[1];
+	    binaryStatsLo[i] = commandBuf.params[2];
+	    binaryStatsHi[i] = commandBuf.params[3];
+	    binaryStatsReset = 1;
+	    binaryAck();
+	}
+	else {
+	    binaryNack();
+	}
+	break;
+
+    case BINARY_COMMAND_TELEM_STATS_RATE:
+	{
+	    float freq = commandBuf.params[0];
+
+	    // summaries per second, 0 stops
+	    if (freq <= 0.0f)
+		binaryStatsWindow = 0;
+	    else if (freq >= RUN_FREQ)
+		binaryStatsWindow = 1;
+	    else if (freq < (float)RUN_FREQ / 0xffff)
+		binaryStatsWindow = 0xffff;
+	    else
+		binaryStatsWindow = RUN_FREQ / freq;
+
+	    binaryStatsReset = 1;
+	    binaryAck();
+	}
+	break;
+
+    // the geometry must not change under a capture or while one is streaming
+    case BINARY_COMMAND_CAPTURE_VALUE:
+	if ((binaryCaptureState == BINARY_CAPTURE_IDLE ||
+		(binaryCaptureState == BINARY_CAPTURE_DONE && !binaryCaptureReq && binaryCaptureSendPos >= binaryCaptureSendEnd)) &&
+		commandBuf.params[0] >= 0.0f && commandBuf.params[0] < BINARY_CAPTURE_COLS && commandBuf.params[1] >= 0.0f && commandBuf.params[1] < BINARY_VALUE_NUM) {
+	    int i;
+
+	    binaryCaptureState = BINARY_CAPTURE_IDLE;
+	    binaryCaptureValues[(int)commandBuf.params[0]] = commandBuf.params[1];
+
+	    binaryCaptureCols = 0;
+	    for (i = 0; i < BINARY_CAPTURE_COLS; i++) {
+		if (binaryCaptureValues[i] != BINARY_VALUE_NONE)
+		    binaryCaptureCols = i+1;
+		else
+		    break;
+	    }
+	    binaryCaptureRows = binaryCaptureCols ? BINARY_CAPTURE_SIZE / binaryCaptureCols : 0;
+
+	    binaryAck();
+	}
+	else {
+	    binaryNack();
+	}
+	break;
+
+    // params: trigger, pre-trigger rows, trigger level
+    case BINARY_COMMAND_CAPTURE_ARM:
+	{
+	    int trig = commandBuf.params[0];
+	    int pre = commandBuf.params[1];
+
+	    if (trig == BINARY_CAPTURE_OFF) {
+		binaryCaptureState = BINARY_CAPTURE_IDLE;
+		binaryAck();
+	    }
+	    else if (trig <= BINARY_CAPTURE_DISARM && binaryCaptureCols && pre >= 0 && pre < binaryCaptureRows) {
+		// SysTick leaves it alone until armed
+		binaryCaptureState = BINARY_CAPTURE_IDLE;
+
+		binaryCaptureTrig = trig;
+		binaryCapturePre = pre;
+		binaryCaptureLevel = commandBuf.params[2];
+		binaryCapturePos = 0;
+		binaryCaptureFilled = 0;
+		binaryCaptureFire = 0;
+		binaryCaptureSeq++;
+
+		binaryCaptureState = BINARY_CAPTURE_ARMED;
+		binaryAck();
+	    }
+	    else {
+		binaryNack();
+	    }
+	}
+	break;
+
+    // resend rows of a finished capture, a count of 0 reads to the end
+    case BINARY_COMMAND_CAPTURE_READ:
+	{
+	    int first = commandBuf.params[0];
+	    int count = commandBuf.params[1];
+
+	    if (binaryCaptureState == BINARY_CAPTURE_DONE && first >= 0 && first < binaryCaptureRows && count >= 0) {
+		if (count == 0 || first + count > binaryCaptureRows)
+		    count = binaryCaptureRows - first;
+
+		binaryCaptureReqFirst = first;
+		binaryCaptureReqEnd = first + count;
+		binaryCaptureReq = 1;
+		binaryAck();
+	    }
+	    else {
+		binaryNack();
+	    }
+	}
+	break;
+
+    case BINARY_COMMAND_TELEM_FORMAT:
+	// only between telemetry runs
+	if (!binaryTelemRate && (commandBuf.params[0] == BINARY_TELEM_FLOAT || commandBuf.params[0] == BINARY_TELEM_FIXED)) {
+	    binaryTelemFormat = commandBuf.params[0];
+	    binaryTelemDelta = (commandBuf.params[1] != 0.0f);
+	    binaryAck();
+	}
+	else {
+	    binaryNack();
+	}
+	break;
+
     case BINARY_COMMAND_SET:
 	if (state <= ESC_STATE_STOPPED && configSetParamByID((int)commandBuf.params[0], commandBuf.params[1])) {
 	    binaryAck();
@@ -279,10 +784,32 @@ void binaryCommandParse(void) {
 	break;
 
     case BINARY_COMMAND_GET_PARAM_ID:
-        paramId = configGetId((char *)&commandBuf.params[0]);
-        sendParamId = commandBuf.seqId;
+        binaryRespond(BINARY_COMMAND_GET_PARAM_ID, configGetId((char *)&commandBuf.params[0]), 0);
         break;
 
+    case BINARY_COMMAND_GET_PARAMS:
+	{
+	    int first = commandBuf.params[0];
+	    int count = commandBuf.params[1];
+
+	    // a count of 0 reads to the last parameter
+	    if (count == 0)
+		count = CONFIG_NUM_PARAMS - first;
+
+	    if (first >= 0 && count > 0 && first + count <= CONFIG_NUM_PARAMS)
+		binaryRespond(BINARY_COMMAND_GET_PARAMS, first, count);
+	    else
+		binaryNack();
+	}
+	break;
+
+    case BINARY_COMMAND_SET_PARAMS:
+	if (state <= ESC_STATE_STOPPED && binarySetParams(&commandBuf.bulk))
+	    binaryAck();
+	else
+	    binaryNack();
+	break;
+
     case BINARY_COMMAND_CONFIG:
 	switch ((int)commandBuf.params[0]) {
 	    case 0:
@@ -305,17 +832,14 @@ void binaryCommandParse(void) {
     default:
 	break;
     }
-
-    // only if telem is not running
-    if (!binaryTelemRate)
-	binaryProcessResponses();
 }
 
 void binaryCommandRead(void) {
     static uint8_t n, i;
     uint8_t c;
 
-    while (serialAvailable()) {
+    // anything after a CLI command is left for the CLI
+    while (!binaryCliReq && serialAvailable()) {
 	c = binaryGetChar(binaryParseState < BINARY_STATE_CHKA);
 
 	switch (binaryParseState) {
@@ -337,7 +861,10 @@ void binaryCommandRead(void) {
 	case BINARY_STATE_SIZE:
 	    n = c;
 	    i = 0;
-	    binaryParseState = BINARY_STATE_PAYLOAD;
+	    if (n == 0 || n > sizeof(commandBuf))
+		binaryParseState = BINARY_STATE_SYNC1;
+	    else
+		binaryParseState = BINARY_STATE_PAYLOAD;
 	    break;
 
 	case BINARY_STATE_PAYLOAD:
@@ -366,90 +893,407 @@ void binaryCommandRead(void) {
     }
 }
 
+// current value of a telemetry column in natural units
+static float binaryTelemValue(uint8_t value) {
+    switch (value) {
+	case BINARY_VALUE_AMPS:
+	    return avgAmps;
+
+	case BINARY_VALUE_VOLTS_BAT:
+	    return avgVolts;
+
+	case BINARY_VALUE_VOLTS_MOTOR:
+	    return (float)fetActualDutyCycle/FET_DUTY_PERIOD*avgVolts;
+
+	case BINARY_VALUE_RPM:
+	    return rpm;
+
+	case BINARY_VALUE_DUTY:
+	    return (float)fetActualDutyCycle/FET_DUTY_PERIOD;
+
+	case BINARY_VALUE_COMM_PERIOD:
+	    return (float)(crossingPeriod/TIMER_MULT);
+
+	case BINARY_VALUE_BAD_DETECTS:
+	    return (float)fetTotalBadDetects;
+
+	case BINARY_VALUE_ADC_WINDOW:
+	    return (float)histSize;
+
+	case BINARY_VALUE_IDLE_PERCENT:
+	    return idlePercent;
+
+	case BINARY_VALUE_STATE:
+	    return (float)state;
+
+	case BINARY_VALUE_AVGA:
+	    return (float)avgA;
+
+	case BINARY_VALUE_AVGB:
+	    return (float)avgB;
+
+	case BINARY_VALUE_AVGC:
+	    return (float)avgC;
+
+	case BINARY_VALUE_AVGCOMP:
+	    return (float)(avgA+avgB+avgC)/3;
+
+	case BINARY_VALUE_FETSTEP:
+	    return (float)fetStep;
+
+	case BINARY_VALUE_START_TIME:
+	    return (float)runStartTime;
+
+	case BINARY_VALUE_FIRST_DETECT_TIME:
+	    return (float)runFirstDetectTime;
+
+	case BINARY_VALUE_FAILED_STARTS:
+	    return (float)runFailedStarts;
+
+	case BINARY_VALUE_REVERSE_TIME:
+	    return (float)runReverseTime;
+
+	case BINARY_VALUE_CMD_LATENCY:
+	    return (float)binaryCmdLatency;
+
+	default:
+	    return 0.0f;
+    }
+}
+
+// a value scaled to its fixed point counts
+static int16_t binaryFixedValue(uint8_t value) {
+    float f = binaryTelemValue(value) * binaryTelemScale[value];
+
+    if (f > 32767.0f)
+	return 32767;
+    else if (f < -32768.0f)
+	return -32768;
+    else
+	return (int32_t)(f + ((f >= 0.0f) ? 0.5f : -0.5f));
+}
+
+// one scaled int16 column, or its change since the last row as an int8
+static void binarySendFixed(int col, uint8_t value, uint8_t delta) {
+    int32_t x, d;
+
+    x = binaryFixedValue(value);
+
+    d = x - binaryTelemLast[col];
+    binaryTelemLast[col] = x;
+
+    if (delta && d > BINARY_TELEM_DELTA_ESC && d <= 127) {
+	*binaryOut++ = (int8_t)d;
+    }
+    else {
+	if (delta)
+	    *binaryOut++ = (int8_t)BINARY_TELEM_DELTA_ESC;
+	binaryPutShort((int16_t)x);
+    }
+}
+
+// SysTick, one row per run loop while armed or triggered
+void binaryCaptureSample(void) {
+    int16_t *row;
+    int i;
+
+    if (binaryCaptureState != BINARY_CAPTURE_ARMED && binaryCaptureState != BINARY_CAPTURE_TRIGGERED)
+	return;
+
+    row = &binaryCaptureBuf[binaryCapturePos * binaryCaptureCols];
+    for (i = 0; i < binaryCaptureCols; i++)
+	row[i] = binaryFixedValue(binaryCaptureValues[i]);
+
+    if (binaryCaptureState == BINARY_CAPTURE_ARMED) {
+	if (binaryCaptureTrig == BINARY_CAPTURE_NOW && binaryCaptureFilled >= binaryCapturePre)
+	    binaryCaptureFire = 1;
+	else if (binaryCaptureTrig == BINARY_CAPTURE_CURRENT && avgAmps >= binaryCaptureLevel)
+	    binaryCaptureFire = 1;
+
+	// this row is the trigger, keep what pre-trigger history there is
+	if (binaryCaptureFire) {
+	    binaryCaptureTrigRow = (binaryCaptureFilled < binaryCapturePre) ? binaryCaptureFilled : binaryCapturePre;
+	    binaryCaptureStart = (binaryCapturePos + binaryCaptureRows - binaryCaptureTrigRow) % binaryCaptureRows;
+	    binaryCaptureLeft = binaryCaptureRows - binaryCaptureTrigRow - 1;
+	    binaryCaptureState = BINARY_CAPTURE_TRIGGERED;
+	}
+    }
+    else {
+	binaryCaptureLeft--;
+    }
+
+    if (binaryCaptureFilled < binaryCaptureRows)
+	binaryCaptureFilled++;
+    binaryCapturePos = (binaryCapturePos + 1) % binaryCaptureRows;
+
+    // full, stream it all out
+    if (binaryCaptureState == BINARY_CAPTURE_TRIGGERED && binaryCaptureLeft == 0) {
+	binaryCaptureState = BINARY_CAPTURE_DONE;
+
+	binaryCaptureReqFirst = 0;
+	binaryCaptureReqEnd = binaryCaptureRows;
+	binaryCaptureReq = 1;
+    }
+}
+
+// may be called from any context
+void binaryCaptureTrigger(uint8_t trigger) {
+    if (binaryCaptureState == BINARY_CAPTURE_ARMED && binaryCaptureTrig == trigger)
+	binaryCaptureFire = 1;
+}
+
+// "AqB" frame of captured rows, oldest first, the trigger at binaryCaptureTrigRow
+static void binaryCaptureSend(void) {
+    uint8_t *frame;
+    int16_t *row;
+    int rows, cols;
+    int n, len;
+    int i, j;
+
+    // the parser may run at any point, size and fill the frame from one geometry
+    rows = binaryCaptureRows;
+    cols = binaryCaptureCols;
+    if (!rows || !cols) {
+	binaryCaptureSendPos = binaryCaptureSendEnd;
+	return;
+    }
+
+    n = binaryCaptureSendEnd - binaryCaptureSendPos;
+    if (n > BINARY_CAPTURE_FRAME_ROWS)
+	n = BINARY_CAPTURE_FRAME_ROWS;
+
+    binaryOut = frame = serialReserve(3 + 2 + 12 + cols + n * cols * 2 + 2);
+
+    // the link sets the pace
+    if (!frame)
+	return;
+
+    *binaryOut++ = 'A';
+    *binaryOut++ = 'q';
+    *binaryOut++ = 'B';
+    binaryOut += 2;				// length
+    binaryPutShort(binaryCaptureSeq);
+    binaryPutShort(RUN_FREQ);
+    binaryPutShort(rows);
+    binaryPutShort(binaryCaptureTrigRow);
+    binaryPutShort(binaryCaptureSendPos);
+    *binaryOut++ = n;
+    *binaryOut++ = cols;
+    for (i = 0; i < cols; i++)
+	*binaryOut++ = binaryCaptureValues[i];
+
+    for (i = binaryCaptureSendPos; i < binaryCaptureSendPos + n; i++) {
+	row = &binaryCaptureBuf[((binaryCaptureStart + i) % rows) * cols];
+	for (j = 0; j < cols; j++)
+	    binaryPutShort(row[j]);
+    }
+
+    len = binaryOut - frame - 5;
+    frame[3] = len;
+    frame[4] = len>>8;
+    binaryPutShort(serialCrc16(frame + 3, len + 2, 0xffff));
+
+    serialCommit(binaryOut - frame);
+    binaryCaptureSendPos += n;
+}
+
+// start a new window with the host's latest settings
+static void binaryStatsStart(void) {
+    binaryStats_t *s;
+    int i;
+
+    for (i = 0; i < BINARY_STATS_NUM; i++) {
+	s = &binaryStats[i];
+
+	s->value = binaryStatsValue[i];
+	s->lo = binaryStatsLo[i];
+	s->hi = binaryStatsHi[i];
+	s->sum = 0.0f;
+	s->sumSq = 0.0f;
+	memset(s->bins, 0, sizeof(s->bins));
+    }
+
+    binaryStatsSamples = 0;
+}
+
+// every run loop, the summaries go out at the window rate
+static void binaryStatsSample(void) {
+    binaryStats_t *s;
+    float v, f;
+    int i, bin;
+
+    for (i = 0; i < BINARY_STATS_NUM; i++) {
+	s = &binaryStats[i];
+
+	if (s->value == BINARY_VALUE_NONE)
+	    continue;
+
+	v = binaryTelemValue(s->value);
+
+	if (binaryStatsSamples == 0) {
+	    s->min = v;
+	    s->max = v;
+	}
+	else if (v < s->min) {
+	    s->min = v;
+	}
+	else if (v > s->max) {
+	    s->max = v;
+	}
+
+	s->sum += v;
+	s->sumSq += v * v;
+
+	f = (v - s->lo) * BINARY_STATS_BINS / (s->hi - s->lo);
+	if (f < 0.0f)
+	    bin = 0;
+	else if (f >= BINARY_STATS_BINS)
+	    bin = BINARY_STATS_BINS - 1;
+	else
+	    bin = f;
+	s->bins[bin]++;
+    }
+
+    if (++binaryStatsSamples >= binaryStatsWindow) {
+	// an unsent summary is replaced by the newer one
+	memcpy(binaryStatsOut, binaryStats, sizeof(binaryStatsOut));
+	binaryStatsOutSamples = binaryStatsSamples;
+	binaryStatsPending = 1;
+
+	binaryStatsStart();
+    }
+}
+
+// "AqA" frame, per signal: value, min, max, mean, RMS and the bin counts
+static void binaryStatsSend(void) {
+    binaryStats_t *s;
+    uint8_t *frame;
+    uint32_t t;
+    int n;
+    int i, j;
+
+    for (n = 0, i = 0; i < BINARY_STATS_NUM; i++)
+	if (binaryStatsOut[i].value != BINARY_VALUE_NONE)
+	    n++;
+
+    binaryOut = frame = serialReserve(3 + 2 + 9 + n * (1 + 4*4 + BINARY_STATS_BINS*2) + 2);
+
+    // try again next loop
+    if (!frame)
+	return;
+
+    t = timerGetMicros() / TIMER_MULT;
+
+    *binaryOut++ = 'A';
+    *binaryOut++ = 'q';
+    *binaryOut++ = 'A';
+    binaryOut += 2;				// length
+    binaryPutShort(binaryStatsSeq++);
+    binaryPutShort(t);
+    binaryPutShort(t >> 16);
+    binaryPutShort(binaryStatsOutSamples);
+    *binaryOut++ = n;
+
+    for (i = 0; i < BINARY_STATS_NUM; i++) {
+	s = &binaryStatsOut[i];
+
+	if (s->value == BINARY_VALUE_NONE)
+	    continue;
+
+	*binaryOut++ = s->value;
+	binaryPutFloat(s->min);
+	binaryPutFloat(s->max);
+	binaryPutFloat(s->sum / binaryStatsOutSamples);
+	binaryPutFloat(sqrtf(s->sumSq / binaryStatsOutSamples));
+	for (j = 0; j < BINARY_STATS_BINS; j++)
+	    binaryPutShort(s->bins[j]);
+    }
+
+    n = binaryOut - frame - 5;
+    frame[3] = n;
+    frame[4] = n>>8;
+    binaryPutShort(serialCrc16(frame + 3, n + 2, 0xffff));
+
+    serialCommit(binaryOut - frame);
+    binaryStatsPending = 0;
+}
+
+// serial rx task, runs from PendSV as soon as a command frame ends
+void binaryRxTask(void) {
+    if (commandMode == BINARY_MODE)
+	binaryCommandRead();
+}
+
 void binaryCheck(void) {
-    static int32_t telemRowsCount;
+    // catch anything that arrived before binary mode was entered
+    if (serialAvailable())
+	serialRxWake();
+
+    if (binaryTelemReset) {
+	binaryTelemReset = 0;
+	binaryFrame = 0;
+	binaryTelemRow = 0;
+    }
 
-    binaryCommandRead();
+    if (binaryStatsReset) {
+	binaryStatsReset = 0;
+	binaryStatsPending = 0;
+	binaryStatsStart();
+    }
+
+    if (binaryStatsWindow)
+	binaryStatsSample();
+
+    // not while a telemetry frame is reserved
+    if (!binaryFrame) {
+	binaryProcessResponses();
+
+	if (binaryCliReq && binaryRespTail == binaryRespHead) {
+	    binaryCliReq = 0;
+	    commandMode = CLI_MODE;
+	    return;
+	}
+
+	if (binaryStatsPending)
+	    binaryStatsSend();
+
+	if (binaryCaptureReq) {
+	    binaryCaptureReq = 0;
+	    binaryCaptureSendPos = binaryCaptureReqFirst;
+	    binaryCaptureSendEnd = binaryCaptureReqEnd;
+	}
+
+	if (binaryCaptureState == BINARY_CAPTURE_DONE && binaryCaptureSendPos < binaryCaptureSendEnd)
+	    binaryCaptureSend();
+    }
 
     if (binaryTelemRate && !(binaryLoop % binaryTelemRate)) {
 	int i;
 
-	// send telemetry data
-	for (i = 0; i < BINARY_VALUE_NUM; i++) {
-	    if (binaryTelemValues[i] != BINARY_VALUE_NONE) {
-		switch (binaryTelemValues[i]) {
-		    case BINARY_VALUE_AMPS:
-			binarySendFloat(avgAmps);
-			break;
-
-		    case BINARY_VALUE_VOLTS_BAT:
-			binarySendFloat(avgVolts);
-			break;
-
-		    case BINARY_VALUE_VOLTS_MOTOR:
-			binarySendFloat((float)fetActualDutyCycle/fetPeriod*avgVolts);
-			break;
-
-		    case BINARY_VALUE_RPM:
-			binarySendFloat(rpm);
-			break;
-
-		    case BINARY_VALUE_DUTY:
-			binarySendFloat((float)fetActualDutyCycle/fetPeriod);
-			break;
-
-		    case BINARY_VALUE_COMM_PERIOD:
-			binarySendFloat((float)(crossingPeriod/TIMER_MULT));
-			break;
-
-		    case BINARY_VALUE_BAD_DETECTS:
-			binarySendFloat((float)fetTotalBadDetects);
-			break;
-
-		    case BINARY_VALUE_ADC_WINDOW:
-			binarySendFloat((float)histSize);
-			break;
-
-		    case BINARY_VALUE_IDLE_PERCENT:
-			binarySendFloat(idlePercent);
-			break;
-
-		    case BINARY_VALUE_STATE:
-			binarySendFloat((float)state);
-			break;
-
-		    case BINARY_VALUE_AVGA:
-			binarySendFloat((float)avgA);
-			break;
-
-		    case BINARY_VALUE_AVGB:
-			binarySendFloat((float)avgB);
-			break;
-
-		    case BINARY_VALUE_AVGC:
-			binarySendFloat((float)avgC);
-			break;
-
-		    case BINARY_VALUE_AVGCOMP:
-			binarySendFloat((float)(avgA+avgB+avgC)/3);
-			break;
-
-		    case BINARY_VALUE_FETSTEP:
-			binarySendFloat((float)fetStep);
-			break;
+	if (binaryTelemRow == 0)
+	    binaryTelemOpen();
+
+	// send telemetry data, only the columns due in this row
+	if (binaryFrame) {
+	    for (i = 0; i < binaryFrameCols; i++) {
+		if (binaryFrameFormat == BINARY_TELEM_FIXED) {
+		    if (!(binaryTelemSample % binaryFrameDiv[i])) {
+			binarySendFixed(i, binaryTelemValues[i], binaryFrameDelta && (binaryFrameSent & (1<<i)));
+			binaryFrameSent |= (1<<i);
+		    }
+		}
+		else {
+		    binaryPutFloat(binaryTelemValue(binaryTelemValues[i]));
 		}
-	    }
-	    else {
-		break;
 	    }
 	}
-	telemRowsCount++;
+	binaryTelemSample++;
 
-	if (telemRowsCount == binaryTelemRows) {
+	if (++binaryTelemRow == binaryFrameRows) {
 	    binaryTelemSend();
-	    telemRowsCount = 0;
+	    binaryTelemRow = 0;
 	}
     }
 
     binaryLoop++;
-}
\ No newline at end of file
+}
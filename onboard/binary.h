@@ -47,10 +47,52 @@ enum binaryCommands {
     BINARY_COMMAND_VERSION,
     BINARY_COMMAND_TELEM_VALUE,
     BINARY_COMMAND_GET_PARAM_ID,
+    BINARY_COMMAND_TELEM_FORMAT,
+    BINARY_COMMAND_GET_PARAMS,
+    BINARY_COMMAND_SET_PARAMS,
+    BINARY_COMMAND_TELEM_DIVIDER,
+    BINARY_COMMAND_TELEM_STATS,
+    BINARY_COMMAND_TELEM_STATS_RATE,
+    BINARY_COMMAND_CAPTURE_VALUE,
+    BINARY_COMMAND_CAPTURE_ARM,
+    BINARY_COMMAND_CAPTURE_READ,
     BINARY_COMMAND_ACK = 250,
     BINARY_COMMAND_NACK
 };
 
+enum binaryTelemFormats {
+    BINARY_TELEM_FLOAT = 1,	    // "AqT" rows of 4 byte floats
+    BINARY_TELEM_FIXED		    // "AqV" rows of scaled int16, optional int8 deltas, per column rates
+};
+
+#define BINARY_RESPONSE_QUEUE	    32	    // commands the host may have in flight
+#define BINARY_PARAMS_PER_FRAME	    32	    // bulk parameter values per frame
+
+#define BINARY_TELEM_MAX_FLOAT_RATE 1000    // Hz
+#define BINARY_TELEM_DELTA_ESC	    -128    // int8 delta escape, absolute int16 follows
+
+#define BINARY_STATS_NUM	    4	    // signals aggregated at once
+#define BINARY_STATS_BINS	    8	    // histogram bins per signal
+
+#define BINARY_CAPTURE_SIZE	    2048    // int16 samples of RAM for burst capture
+#define BINARY_CAPTURE_COLS	    4
+#define BINARY_CAPTURE_FRAME_ROWS   32	    // rows per "AqB" frame
+
+enum binaryCaptureTriggers {
+    BINARY_CAPTURE_OFF = 0,
+    BINARY_CAPTURE_NOW,		    // once the pre-trigger rows are in
+    BINARY_CAPTURE_SETPOINT,	    // a binary DUTY, RPM or PWM command
+    BINARY_CAPTURE_CURRENT,	    // amps at or above the level
+    BINARY_CAPTURE_DISARM
+};
+
+enum binaryCaptureStates {
+    BINARY_CAPTURE_IDLE = 0,
+    BINARY_CAPTURE_ARMED,
+    BINARY_CAPTURE_TRIGGERED,
+    BINARY_CAPTURE_DONE
+};
+
 enum binaryValues {
     BINARY_VALUE_NONE = 0,
     BINARY_VALUE_AMPS,
@@ -68,16 +110,80 @@ enum binaryValues {
     BINARY_VALUE_AVGC,
     BINARY_VALUE_AVGCOMP,
     BINARY_VALUE_FETSTEP,
+    BINARY_VALUE_START_TIME,
+    BINARY_VALUE_FIRST_DETECT_TIME,
+    BINARY_VALUE_FAILED_STARTS,
+    BINARY_VALUE_REVERSE_TIME,
+    BINARY_VALUE_CMD_LATENCY,
     BINARY_VALUE_NUM
 };
 
+// a bulk parameter transfer is one or more frames covering the
+// range txFirst..txFirst+txCount-1, checked as a whole with the hash
+typedef struct {
+    uint8_t first;		    // ids in this frame
+    uint8_t count;
+    uint8_t txFirst;		    // ids in the whole transfer
+    uint8_t txCount;
+    float version;		    // CONFIG_VERSION the ids belong to
+    uint32_t hash;		    // XXH32 of the transfer's values
+    float values[BINARY_PARAMS_PER_FRAME];
+} __attribute__((packed)) binaryParams_t;
+
 typedef struct {
     uint8_t command;
     uint16_t seqId;
-    float params[4];
+    union {
+	float params[4];
+	binaryParams_t bulk;
+    };
 } __attribute__((packed)) binaryCommandStruct_t;
 
+// on-board aggregation of one signal over a summary window
+typedef struct {
+    uint8_t value;		    // BINARY_VALUE_NONE if unused
+    float lo, hi;		    // histogram range, the end bins take the overflow
+    float min, max;
+    float sum, sumSq;
+    uint16_t bins[BINARY_STATS_BINS];
+} binaryStats_t;
+
+// STATUS reply payload, taken in one go
+typedef struct {
+    uint32_t micros;		    // time of the snapshot
+    uint8_t state;
+    uint8_t runMode;
+    uint8_t inputMode;
+    uint8_t disarmReason;
+    float rpm;
+    float amps;
+    float volts;		    // battery
+    float duty;			    // %
+    uint32_t badDetects;
+    float idlePercent;
+} __attribute__((packed)) binaryStatus_t;
+
+// VERSION reply payload
+typedef struct {
+    char version[16];		    // firmware
+    float configVersion;
+} __attribute__((packed)) binaryVersion_t;
+
+typedef struct {
+    uint8_t command;		    // ACK, NACK or a command with a reply
+    uint16_t seqId;
+    int16_t value;
+    uint8_t count;
+} binaryResponse_t;
+
+extern const float binaryTelemScale[BINARY_VALUE_NUM];
+extern uint32_t binaryCmdLatency;
+extern uint32_t binaryCmdMaxLatency;
+
 extern void binaryCheck(void);
+extern void binaryRxTask(void);
+extern void binaryCaptureSample(void);
+extern void binaryCaptureTrigger(uint8_t trigger);
 extern void configRecalcConst(void);
 
 #endif
\ No newline at end of file
@@ -22,11 +22,21 @@
 #include "run.h"
 #include "pwm.h"
 #include "fet.h"
+#include "adc.h"
 #include "misc.h"
 #include "timer.h"
 #include "xxhash.h"
 
 canDataStruct_t canData;
+timerEvent_t canSyncEvent;
+
+// filled by the RX interrupts, drained by canProcess()
+canRxFrame_t canRxQueue[CAN_RX_QUEUE];
+volatile uint8_t canRxHead, canRxTail;
+
+// one queue per LCC, drained highest priority first by the TX empty interrupt
+canTxFrame_t canTxQueue[CAN_TX_PRIORITIES][CAN_TX_QUEUE];
+volatile uint8_t canTxHead[CAN_TX_PRIORITIES], canTxTail[CAN_TX_PRIORITIES];
 
 static inline uint32_t canGetSeqId(void) {
     uint32_t seqId;
@@ -52,30 +62,70 @@ static inline int8_t canGetFreeMailbox(void) {
     return mailbox;
 }
 
-static int8_t canSend(uint32_t id, uint8_t tid, uint8_t seqId, uint8_t n, void *data) {
+// fill any empty mailboxes from the queues, must be called with interrupts off
+static void canTxFill(void) {
+    canTxFrame_t *frame;
     int8_t mailbox;
+    int i;
+
+    for (i = 0; i < CAN_TX_PRIORITIES; i++) {
+	while (canTxTail[i] != canTxHead[i]) {
+	    if ((mailbox = canGetFreeMailbox()) < 0)
+		return;
+
+	    frame = &canTxQueue[i][canTxTail[i]];
+
+	    CAN_CAN->sTxMailBox[mailbox].TIR = frame->tir;
+	    CAN_CAN->sTxMailBox[mailbox].TDTR = frame->tdtr;
+	    CAN_CAN->sTxMailBox[mailbox].TDLR = frame->data[0];
+	    CAN_CAN->sTxMailBox[mailbox].TDHR = frame->data[1];
+	    CAN_CAN->sTxMailBox[mailbox].TIR |= 0x1;
+
+	    canTxTail[i] = (canTxTail[i] + 1) & (CAN_TX_QUEUE - 1);
+	}
+    }
+}
+
+static int8_t canSend(uint32_t id, uint8_t tid, uint8_t seqId, uint8_t n, void *data) {
+    canTxFrame_t *frame;
     uint32_t *d = data;
+    uint8_t prio, head, depth;
+    int8_t ret = 0;
+
+    prio = (id & CAN_LCC_MASK)>>30;
+
+    __asm volatile ("cpsid i");
 
-    mailbox = canGetFreeMailbox();
+    head = (canTxHead[prio] + 1) & (CAN_TX_QUEUE - 1);
+    if (head == canTxTail[prio]) {
+	canData.txDropped[prio]++;
+	ret = -1;
+    }
+    else {
+	frame = &canTxQueue[prio][canTxHead[prio]];
 
-    if (mailbox >= 0) {
-	CAN_CAN->sTxMailBox[mailbox].TIR = id | (canData.networkId<<14) | ((tid & 0x1f)<<9) | (seqId<<3) | CAN_Id_Extended;
+	frame->tir = id | (canData.networkId<<14) | ((tid & 0x1f)<<9) | (seqId<<3) | CAN_Id_Extended;
 
 	n = n & 0xf;
-	CAN_CAN->sTxMailBox[mailbox].TDTR = n;
+	frame->tdtr = n;
 
 	if (n) {
-	    CAN_CAN->sTxMailBox[mailbox].TDLR = *d++;
-	    CAN_CAN->sTxMailBox[mailbox].TDHR = *d;
+	    frame->data[0] = *d++;
+	    frame->data[1] = *d;
 	}
 
-	CAN_CAN->sTxMailBox[mailbox].TIR |= 0x1;
-    }
-    else {
-	canData.mailboxFull++;
+	canTxHead[prio] = head;
+
+	depth = (head - canTxTail[prio]) & (CAN_TX_QUEUE - 1);
+	if (depth > canData.txQueueMax[prio])
+	    canData.txQueueMax[prio] = depth;
+
+	canTxFill();
     }
 
-    return mailbox;
+    __asm volatile ("cpsie i");
+
+    return ret;
 }
 
 static inline void canNack(canPacket_t *pkt) {
@@ -120,7 +170,7 @@ static inline void canFilterGroup(void) {
 	CAN_FilterInitStructure.CAN_FilterIdLow = canData.groupId<<9;
 	CAN_FilterInitStructure.CAN_FilterMaskIdHigh = CAN_TT_MASK>>16;
 	CAN_FilterInitStructure.CAN_FilterMaskIdLow = CAN_TID_MASK;
-	CAN_FilterInitStructure.CAN_FilterFIFOAssignment = 0;	    // TODO: perhaps use FIFO2 & interrupt
+	CAN_FilterInitStructure.CAN_FilterFIFOAssignment = 1;	    // group setpoints get their own FIFO
 	CAN_FilterInitStructure.CAN_FilterActivation = ENABLE;
 	CAN_FilterInit(&CAN_FilterInitStructure);
     }
@@ -159,6 +209,18 @@ static inline void canProcessAddr(canPacket_t *pkt) {
 	CAN_FilterInitStructure.CAN_FilterActivation = ENABLE;
 	CAN_FilterInit(&CAN_FilterInitStructure);
 
+	// and time sync, alongside the group setpoints
+	CAN_FilterInitStructure.CAN_FilterNumber = 3;
+	CAN_FilterInitStructure.CAN_FilterMode = CAN_FilterMode_IdMask;
+	CAN_FilterInitStructure.CAN_FilterScale = CAN_FilterScale_32bit;
+	CAN_FilterInitStructure.CAN_FilterIdHigh = CAN_FID_SYNC>>16;
+	CAN_FilterInitStructure.CAN_FilterIdLow = 0x0000;
+	CAN_FilterInitStructure.CAN_FilterMaskIdHigh = CAN_FID_MASK>>16;
+	CAN_FilterInitStructure.CAN_FilterMaskIdLow = 0x0000;
+	CAN_FilterInitStructure.CAN_FilterFIFOAssignment = 1;
+	CAN_FilterInitStructure.CAN_FilterActivation = ENABLE;
+	CAN_FilterInit(&CAN_FilterInitStructure);
+
 	// if we got a ground assignment
 	if (canData.groupId)
 	    canFilterGroup();
@@ -176,8 +238,18 @@ static void inline canBusReset(void) {
     canData.subGroupId = 0;
     canData.telemRate = 0;
 
-    for (i = 0; i < CAN_TELEM_NUM; i++)
+    timerCancel(&canSyncEvent);
+    canData.syncMode = 0;
+    canData.syncStaged = 0;
+    canData.syncPending = 0;
+    canData.syncValid = 0;
+    canData.syncLocked = 0;
+
+    for (i = 0; i < CAN_TELEM_NUM; i++) {
 	canData.telemValues[i] = 0;
+	canData.telemRates[i] = 0;
+	canData.telemDivs[i] = 0;
+    }
 
 
     // Initially only listen for CAN_FID_GRANT_ADDR
@@ -200,10 +272,46 @@ static void inline canBusReset(void) {
     CAN_FilterInitStructure.CAN_FilterActivation = DISABLE;
     CAN_FilterInit(&CAN_FilterInitStructure);
 
+    CAN_FilterInitStructure.CAN_FilterNumber = 3;
+    CAN_FilterInitStructure.CAN_FilterActivation = DISABLE;
+    CAN_FilterInit(&CAN_FilterInitStructure);
+
     // ask for new address
     canSendGetAddr();
 }
 
+static void canTelemCalcDivs(void) {
+    uint16_t rate;
+    int i;
+
+    for (i = 0; i < CAN_TELEM_NUM; i++) {
+	rate = canData.telemRates[i] ? canData.telemRates[i] : canData.telemRate;
+
+	if (canData.telemValues[i] && rate)
+	    canData.telemDivs[i] = RUN_FREQ / rate;
+	else
+	    canData.telemDivs[i] = 0;
+    }
+}
+
+// slot, value, [rate]
+static int canTelemSetValue(uint8_t slot, uint8_t value, int setRate, uint16_t rate) {
+    // no temperature sensor on this board
+    if (slot >= CAN_TELEM_NUM || value >= CAN_TELEM_NUM || value == CAN_TELEM_TEMP)
+	return 0;
+
+    if (setRate) {
+	if (rate > RUN_FREQ)
+	    rate = RUN_FREQ;
+	canData.telemRates[slot] = rate;
+    }
+
+    canData.telemValues[slot] = value;
+    canTelemCalcDivs();
+
+    return 1;
+}
+
 static inline void canProcessSet(canPacket_t *pkt) {
     switch (pkt->doc) {
     case CAN_DATA_GROUP:
@@ -246,12 +354,34 @@ static inline void canProcessSet(canPacket_t *pkt) {
 	canSetParam(pkt);
 	break;
 
+    case CAN_DATA_SYNC:
+	if (*(uint8_t *)pkt->data <= 1) {
+	    canData.syncMode = *(uint8_t *)pkt->data;
+	    canData.syncStaged = 0;
+	    canAck(pkt);
+	}
+	else {
+	    canNack(pkt);
+	}
+	break;
+
     case CAN_DATA_TELEM:
-	canNack(pkt);
+	if (canTelemSetValue(((uint8_t *)pkt->data)[0], ((uint8_t *)pkt->data)[1], 1, ((uint16_t *)pkt->data)[1]))
+	    canAck(pkt);
+	else
+	    canNack(pkt);
 	break;
     }
 }
 
+static void canSyncStatus(esc32CanSync_t *t) {
+    t->error = (canData.syncError > 32767) ? 32767 : ((canData.syncError < -32768) ? -32768 : canData.syncError);
+    t->maxError = (canData.syncMaxError > 0xffff) ? 0xffff : canData.syncMaxError;
+    t->syncs = canData.syncCount;
+    t->locked = canData.syncLocked;
+    t->late = (canData.syncLate > 0xff) ? 0xff : canData.syncLate;
+}
+
 static inline void canProcessGet(canPacket_t *pkt) {
     int16_t paramId;
     uint8_t *p1, *p2;
@@ -333,13 +463,27 @@ static inline void canProcessGet(canPacket_t *pkt) {
 	canReply(pkt, 8);
 	break;
 
+    case CAN_DATA_SYNC:
+	canSyncStatus((esc32CanSync_t *)pkt->data);
+	canReply(pkt, sizeof(esc32CanSync_t));
+	break;
+
     case CAN_DATA_TELEM:
-	// TODO
+	if (((uint8_t *)pkt->data)[0] < CAN_TELEM_NUM) {
+	    uint8_t slot = ((uint8_t *)pkt->data)[0];
+
+	    ((uint8_t *)pkt->data)[1] = canData.telemValues[slot];
+	    ((uint16_t *)pkt->data)[1] = canData.telemRates[slot];
+	    canReply(pkt, 4);
+	}
+	else {
+	    canNack(pkt);
+	}
 	break;
     }
 }
 
-static inline void canProcessSetpoint10(canPacket_t *pkt) {
+static inline uint16_t canProcessSetpoint10(canPacket_t *pkt) {
     uint16_t val;
 
     if ((pkt->id & CAN_TT_MASK) != CAN_TT_NODE) {
@@ -370,10 +514,10 @@ static inline void canProcessSetpoint10(canPacket_t *pkt) {
 	val = *pkt->data;
     }
 
-    runSetpoint(val<<6);
+    return val<<6;
 }
 
-static inline void canProcessSetpoint12(canPacket_t *pkt) {
+static inline uint16_t canProcessSetpoint12(canPacket_t *pkt) {
     uint16_t val;
 
     if ((pkt->id & CAN_TT_MASK) == CAN_TT_GROUP) {
@@ -401,10 +545,10 @@ static inline void canProcessSetpoint12(canPacket_t *pkt) {
 	val = *pkt->data;
     }
 
-    runSetpoint(val<<4);
+    return val<<4;
 }
 
-static inline void canProcessSetpoint16(canPacket_t *pkt) {
+static inline uint16_t canProcessSetpoint16(canPacket_t *pkt) {
     uint16_t val;
 
     if ((pkt->id & CAN_TT_MASK) == CAN_TT_GROUP) {
@@ -429,10 +573,10 @@ static inline void canProcessSetpoint16(canPacket_t *pkt) {
 	val = *pkt->data;
     }
 
-    runSetpoint(val);
+    return val;
 }
 
-static inline void canProcessRpm(canPacket_t *pkt) {
+static inline uint16_t canProcessRpm(canPacket_t *pkt) {
     uint16_t val;
 
     if ((pkt->id & CAN_TT_MASK) == CAN_TT_GROUP) {
@@ -457,8 +601,7 @@ static inline void canProcessRpm(canPacket_t *pkt) {
 	val = *pkt->data;
     }
 
-    runMode = CLOSED_LOOP_RPM;
-    targetRpm = (float)val;
+    return val;
 }
 
 static inline void canProcessBeep(canPacket_t *pkt) {
@@ -480,29 +623,287 @@ void canSendStatus(void) {
     stat.vin = avgVolts * 100;
     stat.amps = avgAmps * 100;
     stat.rpm = rpm;
-    stat.duty = fetActualDutyCycle * 255 / fetPeriod / 100;
+    stat.duty = fetActualDutyCycle * 255 / FET_DUTY_PERIOD / 100;
     stat.errors = fetTotalBadDetects;
     stat.errCode = disarmReason;
 
     canSend(CAN_LCC_INFO | CAN_TT_NODE | CAN_FID_TELEM | (CAN_TELEM_STATUS<<19), 0, canGetSeqId(), 8, &stat);
 }
 
-void canTelemDo(void) {
+static inline uint16_t canTelemClip(float val) {
+    if (val < 0.0f)
+	return 0;
+    else if (val > 65535.0f)
+	return 65535;
+    else
+	return val;
+}
+
+static void canSendTelem(uint8_t value) {
+    uint32_t id = CAN_LCC_INFO | CAN_TT_NODE | CAN_FID_TELEM | (value<<19);
+    uint32_t d[2];
+    uint32_t lost;
+    uint8_t n;
     int i;
 
-    for (i = 0; i < CAN_TELEM_NUM; i++) {
-	switch (canData.telemValues[i]) {
-	    case 0:
-		break;
+    switch (value) {
+    case CAN_TELEM_STATUS:
+	canSendStatus();
+	return;
 
-	    case CAN_TELEM_STATUS:
-		canSendStatus();
-		break;
+    case CAN_TELEM_STATE: {
+	esc32CanState_t *t = (esc32CanState_t *)d;
 
-	    default:
-		break;
+	t->state = state;
+	t->runMode = runMode;
+	t->inputMode = inputMode;
+	t->disarmReason = disarmReason;
+	n = sizeof(*t);
+	break;
+    }
+
+    case CAN_TELEM_VIN: {
+	esc32CanVin_t *t = (esc32CanVin_t *)d;
+
+	t->batVolts = canTelemClip(avgVolts * 100.0f);
+	t->motorVolts = canTelemClip(avgVolts * fetActualDutyCycle / FET_DUTY_PERIOD * 100.0f);
+	n = sizeof(*t);
+	break;
+    }
+
+    case CAN_TELEM_AMPS: {
+	esc32CanAmps_t *t = (esc32CanAmps_t *)d;
+
+	t->avgAmps = canTelemClip(avgAmps * 100.0f);
+	t->maxAmps = canTelemClip((adcMaxAmps - adcAmpsOffset) * adcToAmps * 100.0f);
+	n = sizeof(*t);
+	break;
+    }
+
+    case CAN_TELEM_RPM: {
+	esc32CanRpm_t *t = (esc32CanRpm_t *)d;
+
+	t->rpm = canTelemClip(rpm);
+	t->targetRpm = canTelemClip(targetRpm);
+	t->duty = canTelemClip((float)fetActualDutyCycle * 10000.0f / FET_DUTY_PERIOD);
+	n = sizeof(*t);
+	break;
+    }
+
+    case CAN_TELEM_ERRORS: {
+	esc32CanErrors_t *t = (esc32CanErrors_t *)d;
+
+	lost = canData.rxDropped + canData.rxOverruns;
+	for (i = 0; i < CAN_TX_PRIORITIES; i++)
+	    lost += canData.txDropped[i];
+
+	t->badDetects = fetTotalBadDetects;
+	t->failedStarts = (runFailedStarts > 0xffff) ? 0xffff : runFailedStarts;
+	t->canLost = (lost > 0xffff) ? 0xffff : lost;
+	n = sizeof(*t);
+	break;
+    }
+
+    case CAN_TELEM_SYNC:
+	canSyncStatus((esc32CanSync_t *)d);
+	n = sizeof(esc32CanSync_t);
+	break;
+
+    default:
+	return;
+    }
+
+    canSend(id, 0, canGetSeqId(), n, d);
+}
+
+// each value runs on its own divider, phased by network ID and slot so
+// that ESCs sharing the bus do not all report on the same tick
+void canTelemDo(uint32_t loops) {
+    uint32_t phase;
+    int i;
+
+    phase = loops + canData.networkId * CAN_TELEM_NUM;
+
+    for (i = 0; i < CAN_TELEM_NUM; i++)
+	if (canData.telemDivs[i] && !((phase + i) % canData.telemDivs[i]))
+	    canSendTelem(canData.telemValues[i]);
+}
+
+// a held setpoint does not count as an update for the CAN timeout
+static void canApplySetpoint(uint8_t doc, uint16_t val) {
+    canData.validMicros = timerMicros;
+
+    if (doc == CAN_CMD_RPM) {
+	runMode = CLOSED_LOOP_RPM;
+	targetRpm = (float)val;
+    }
+    else {
+	runSetpoint(val);
+    }
+}
+
+static void canApplyStaged(void) {
+    uint32_t staged = canData.syncStaged;
+
+    if (staged) {
+	canData.syncStaged = 0;
+	canApplySetpoint(staged>>16, staged);
+    }
+}
+
+// Worked out before the alarm is scheduled so that the timer ISR only
+// stores the result.  Cleared first, the alarm may preempt us.
+static void canSyncPrepare(uint32_t staged) {
+    uint8_t mode = (staged>>16 == CAN_CMD_RPM) ? CLOSED_LOOP_RPM : runMode;
+
+    canData.syncPrepared = 0;
+
+    if (mode == SERVO_MODE)
+	return;
+
+    if (staged>>16 == CAN_CMD_RPM)
+	canData.syncRpm = (float)(uint16_t)staged;
+    else if (mode == OPEN_LOOP)
+	canData.syncDuty = runSetpointTarget(mode, staged);
+    else
+	canData.syncRpm = runSetpointTarget(mode, staged);
+
+    canData.syncRunMode = mode;
+    canData.syncPrepared = staged;
+}
+
+// timer ISR.  A running motor only has its duty or target changed, which
+// is safe from here; anything that may start or reverse it, or a setpoint
+// that changed since it was prepared, waits for SysTick.
+static void canSyncAlarm(int parameter) {
+    uint32_t staged = canData.syncStaged;
+
+    if (state == ESC_STATE_RUNNING && !p[BIDIRECTIONAL] && staged && staged == canData.syncPrepared &&
+	    (staged>>16 == CAN_CMD_RPM || runMode == canData.syncRunMode)) {
+	canData.syncStaged = 0;
+	canData.validMicros = timerMicros;
+
+	runMode = canData.syncRunMode;
+	if (runMode == OPEN_LOOP)
+	    fetSetDutyCycle(canData.syncDuty);
+	else
+	    targetRpm = canData.syncRpm;
+    }
+    else {
+	canData.syncPending = 1;
+    }
+}
+
+// The master's sync frame carries its transmit time of the previous sync
+// frame, so each pair gives one master / local offset.  The change between
+// consecutive offsets is the sync error.
+static inline void canProcessSync(canPacket_t *pkt, uint32_t rxTicks) {
+    uint32_t offset;
+    int32_t err;
+    uint8_t seq;
+
+    seq = ((uint8_t *)pkt->data)[4];
+
+    if (canData.syncValid && seq == (uint8_t)(canData.syncSeq + 1)) {
+	offset = pkt->data[0] * TIMER_MULT - canData.syncRxTicks;
+
+	if (canData.syncLocked) {
+	    err = (int32_t)(offset - canData.syncOffset) / TIMER_MULT;
+	    canData.syncError = err;
+	    if (err < 0)
+		err = -err;
+	    if (err > canData.syncMaxError)
+		canData.syncMaxError = err;
 	}
+
+	canData.syncOffset = offset;
+	canData.syncLocked = 1;
+	canData.syncCount++;
+    }
+
+    canData.syncSeq = seq;
+    canData.syncRxTicks = rxTicks;
+    canData.syncValid = 1;
+}
+
+// apply the staged setpoint at a master time
+static inline void canProcessSyncApply(canPacket_t *pkt) {
+    int32_t ticks;
+
+    if (!canData.syncStaged)
+	return;
+
+    ticks = (int32_t)(pkt->data[0] * TIMER_MULT - canData.syncOffset - timerGetMicros());
+
+    if (!canData.syncLocked) {
+	canApplyStaged();
+    }
+    else if (ticks <= 0 || ticks > CAN_SYNC_MAX_DELAY) {
+	canData.syncLate++;
+	canApplyStaged();
+    }
+    else {
+	canSyncPrepare(canData.syncStaged);
+
+	if (!timerSchedule(&canSyncEvent, ticks, canSyncAlarm, 0))
+	    canApplyStaged();
+    }
+}
+
+// setpoints and sync are acted on straight from the receive interrupt, returns 0 if not one
+static inline int canProcessSetpoint(canPacket_t *pkt, uint32_t rxTicks) {
+    uint16_t val;
+
+    if ((pkt->id & CAN_FID_MASK) == CAN_FID_SYNC) {
+	canProcessSync(pkt, rxTicks);
+	return 1;
+    }
+
+    if ((pkt->id & CAN_FID_MASK) != CAN_FID_CMD)
+	return 0;
+
+    switch (pkt->doc) {
+    case CAN_CMD_SYNC_APPLY:
+	canProcessSyncApply(pkt);
+	return 1;
+
+    case CAN_CMD_SETPOINT10:
+    case CAN_CMD_SETPOINT12:
+    case CAN_CMD_SETPOINT16:
+    case CAN_CMD_RPM:
+	break;
+
+    default:
+	return 0;
+    }
+
+    inputMode = ESC_INPUT_CAN;
+
+    switch (pkt->doc) {
+    case CAN_CMD_SETPOINT10:
+	val = canProcessSetpoint10(pkt);
+	break;
+
+    case CAN_CMD_SETPOINT12:
+	val = canProcessSetpoint12(pkt);
+	break;
+
+    case CAN_CMD_SETPOINT16:
+	val = canProcessSetpoint16(pkt);
+	break;
+
+    case CAN_CMD_RPM:
+	val = canProcessRpm(pkt);
+	break;
     }
+
+    // held until the group's SYNC_APPLY
+    if (canData.syncMode)
+	canData.syncStaged = (uint32_t)pkt->doc<<16 | val;
+    else
+	canApplySetpoint(pkt->doc, val);
+
+    return 1;
 }
 
 static inline void canProcessCmd(canPacket_t *pkt) {
@@ -531,26 +932,6 @@ static inline void canProcessCmd(canPacket_t *pkt) {
 	canAck(pkt);
 	break;
 
-    case CAN_CMD_SETPOINT10:
-	canData.validMicros = timerMicros;
-	canProcessSetpoint10(pkt);
-	break;
-
-    case CAN_CMD_SETPOINT12:
-	canData.validMicros = timerMicros;
-	canProcessSetpoint12(pkt);
-	break;
-
-    case CAN_CMD_SETPOINT16:
-	canData.validMicros = timerMicros;
-	canProcessSetpoint16(pkt);
-	break;
-
-    case CAN_CMD_RPM:
-	canData.validMicros = timerMicros;
-	canProcessRpm(pkt);
-	break;
-
     case CAN_CMD_CFG_READ:
 	if (state <= ESC_STATE_STOPPED) {
 	    configReadFlash();
@@ -582,12 +963,15 @@ static inline void canProcessCmd(canPacket_t *pkt) {
 	canData.telemRate = *(uint16_t *)pkt->data;
 	if (canData.telemRate > RUN_FREQ)
 	    canData.telemRate = RUN_FREQ;
+	canTelemCalcDivs();
 	canAck(pkt);
 	break;
 
     case CAN_CMD_TELEM_VALUE:
-	canData.telemValues[data[0]] = data[1];
-	canAck(pkt);
+	if (canTelemSetValue(data[0], data[1], 0, 0))
+	    canAck(pkt);
+	else
+	    canNack(pkt);
 	break;
 
     case CAN_CMD_RESET:
@@ -619,18 +1003,36 @@ static inline void canProcessCmd(canPacket_t *pkt) {
     }
 }
 
+static inline void canDecode(canPacket_t *pkt, uint32_t id, uint32_t *data) {
+    pkt->id = id;
+    pkt->doc = (id & CAN_DOC_MASK)>>19;
+    pkt->sid = (id & CAN_SID_MASK)>>14;
+    pkt->tid = (id & CAN_TID_MASK)>>9;
+    pkt->seq = (id & CAN_SEQ_MASK)>>3;
+    pkt->data = data;
+}
+
 void canProcess(void) {
     static uint32_t loops = 0;
-    CanRxMsg rx;
+    canRxFrame_t *frame;
     canPacket_t pkt;
+    uint32_t data[2];
 
     loops++;
 
     // telemetry
-    if (canData.telemRate && !(loops % (RUN_FREQ / canData.telemRate)))
-	canTelemDo();
+    canTelemDo(loops);
 
-    if (CAN_MessagePending(CAN_CAN, CAN_FIFO0) == 0) {
+    // a synchronized setpoint the timer ISR could not apply
+    if (canData.syncPending) {
+	canData.syncPending = 0;
+	canApplyStaged();
+    }
+
+    if (canData.syncLocked && (timerMicros - canData.syncRxTicks) > CAN_SYNC_TIMEOUT)
+	canData.syncLocked = 0;
+
+    if (canRxTail == canRxHead) {
 	// keep trying to get an address
 	if (canData.networkId == 0 && !(loops % (100 * 1000 / RUN_FREQ)))
 	    canSendGetAddr();
@@ -638,22 +1040,18 @@ void canProcess(void) {
 	return;
     }
 
-    CAN_Receive(CAN_CAN, CAN_FIFO0, &rx);
-
-    // ignore standard id's
-    if (rx.IDE != CAN_Id_Standard) {
-	pkt.id = rx.ExtId << 3;
-	pkt.doc = (pkt.id & CAN_DOC_MASK)>>19;
-	pkt.sid = (pkt.id & CAN_SID_MASK)>>14;
-	pkt.tid = (pkt.id & CAN_TID_MASK)>>9;
-	pkt.seq = (pkt.id & CAN_SEQ_MASK)>>3;
-	pkt.data = (uint32_t *)rx.Data;
-	canData.packetsReceived++;
+    // deferred frames, handlers may write their reply into the data
+    while (canRxTail != canRxHead) {
+	frame = &canRxQueue[canRxTail];
+	data[0] = frame->data[0];
+	data[1] = frame->data[1];
+	canDecode(&pkt, frame->id, data);
+	canRxTail = (canRxTail + 1) & (CAN_RX_QUEUE - 1);
 
 	// do we need a network address?
 	if (canData.networkId == 0 && (pkt.id & CAN_FID_GRANT_ADDR)) {
 	    canProcessAddr(&pkt);
-	    return;
+	    continue;
 	}
 
 	switch (pkt.id & CAN_FID_MASK) {
@@ -692,6 +1090,55 @@ void canProcess(void) {
     }
 }
 
+// drain a hardware FIFO, setpoints are handled here and the rest queued
+static inline void canReceive(uint8_t fifo) {
+    uint32_t rxTicks = timerGetMicros();
+    volatile uint32_t *rfr = (fifo == CAN_FIFO0) ? &CAN_CAN->RF0R : &CAN_CAN->RF1R;
+    CAN_FIFOMailBox_TypeDef *mbox = &CAN_CAN->sFIFOMailBox[fifo];
+    canRxFrame_t *frame;
+    canPacket_t pkt;
+    uint32_t data[2];
+    uint32_t id;
+    uint8_t head;
+
+    while (*rfr & CAN_RF0R_FMP0) {
+	id = mbox->RIR;
+	data[0] = mbox->RDLR;
+	data[1] = mbox->RDHR;
+
+	// release the mailbox
+	*rfr = CAN_RF0R_RFOM0;
+
+	// ignore standard id's
+	if (!(id & CAN_Id_Extended))
+	    continue;
+
+	id = (id>>3)<<3;
+	canData.packetsReceived++;
+
+	canDecode(&pkt, id, data);
+	if (canData.networkId && canProcessSetpoint(&pkt, rxTicks))
+	    continue;
+
+	head = (canRxHead + 1) & (CAN_RX_QUEUE - 1);
+	if (head == canRxTail) {
+	    canData.rxDropped++;
+	    continue;
+	}
+
+	frame = &canRxQueue[canRxHead];
+	frame->id = id;
+	frame->data[0] = data[0];
+	frame->data[1] = data[1];
+	canRxHead = head;
+    }
+
+    if (*rfr & CAN_RF0R_FOVR0) {
+	canData.rxOverruns++;
+	*rfr = CAN_RF0R_FOVR0;
+    }
+}
+
 void canInit(void) {
     GPIO_InitTypeDef GPIO_InitStructure;
     CAN_InitTypeDef CAN_InitStructure;
@@ -729,26 +1176,26 @@ void canInit(void) {
     CAN_Init(CAN_CAN, &CAN_InitStructure);
 
     NVIC_InitStructure.NVIC_IRQChannel = USB_LP_CAN1_RX0_IRQn;
-    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 2;
+    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 3;
     NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
     NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
     NVIC_Init(&NVIC_InitStructure);
 
     NVIC_InitStructure.NVIC_IRQChannel = CAN1_RX1_IRQn;
-    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 2;
+    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 3;
     NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
     NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
     NVIC_Init(&NVIC_InitStructure);
 
     NVIC_InitStructure.NVIC_IRQChannel = USB_HP_CAN1_TX_IRQn;
-    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 2;
+    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 3;
     NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
     NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
     NVIC_Init(&NVIC_InitStructure);
 
-//    CAN_ITConfig(CAN_CAN, CAN_IT_TME, ENABLE);
-//    CAN_ITConfig(CAN_CAN, CAN_IT_FMP0, ENABLE);
-//    CAN_ITConfig(CAN_CAN, CAN_IT_FMP1, ENABLE);
+    CAN_ITConfig(CAN_CAN, CAN_IT_TME, ENABLE);
+    CAN_ITConfig(CAN_CAN, CAN_IT_FMP0 | CAN_IT_FOV0, ENABLE);
+    CAN_ITConfig(CAN_CAN, CAN_IT_FMP1 | CAN_IT_FOV1, ENABLE);
 
     canData.uuid = XXH32((void *)CAN_UUID, 3*4, 0);
 
@@ -757,13 +1204,20 @@ void canInit(void) {
 }
 
 void USB_LP_CAN1_RX0_IRQHandler(void) {
+    canReceive(CAN_FIFO0);
 }
 
 void canSetConstants(void) {
 }
 
 void CAN1_RX1_IRQHandler(void) {
+    canReceive(CAN_FIFO1);
 }
 
 void USB_HP_CAN1_TX_IRQHandler(void)  {
+    CAN_CAN->TSR = CAN_TSR_RQCP0 | CAN_TSR_RQCP1 | CAN_TSR_RQCP2;
+
+    __asm volatile ("cpsid i");
+    canTxFill();
+    __asm volatile ("cpsie i");
 }
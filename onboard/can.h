@@ -29,6 +29,12 @@
 #define CAN_UUID	0x1FFFF7E8
 
 #define CAN_TIMEOUT	    (200000*TIMER_MULT)	    // 0.2 secs
+#define CAN_SYNC_TIMEOUT    (1000000*TIMER_MULT)    // lose sync lock after 1 sec without a sync frame
+#define CAN_SYNC_MAX_DELAY  (100000*TIMER_MULT)	    // furthest ahead a setpoint may be scheduled
+
+#define CAN_RX_QUEUE	    16			    // must be a power of 2
+#define CAN_TX_QUEUE	    8			    // per priority, must be a power of 2
+#define CAN_TX_PRIORITIES   4			    // one per LCC
 
 // Logical Communications Channel
 // 2 bits [28:27]
@@ -59,6 +65,7 @@
 #define CAN_FID_ERROR	    ((uint32_t)0x9<<25)
 #define CAN_FID_PING	    ((uint32_t)0xa<<25)
 #define CAN_FID_TELEM	    ((uint32_t)0xb<<25)
+#define CAN_FID_SYNC	    ((uint32_t)0xc<<25)
 
 // Data Object Code
 // 6 bits [21:16]
@@ -109,7 +116,8 @@ enum {
     CAN_CMD_RESET,
     CAN_CMD_STREAM,
     CAN_CMD_ON,
-    CAN_CMD_OFF
+    CAN_CMD_OFF,
+    CAN_CMD_SYNC_APPLY
 };
 
 // data types
@@ -125,7 +133,8 @@ enum {
     CAN_DATA_VERSION,
     CAN_DATA_VALUE,
     CAN_DATA_PARAM_NAME1,
-    CAN_DATA_PARAM_NAME2
+    CAN_DATA_PARAM_NAME2,
+    CAN_DATA_SYNC
 };
 
 // telemetry values
@@ -138,6 +147,7 @@ enum {
     CAN_TELEM_AMPS,
     CAN_TELEM_RPM,
     CAN_TELEM_ERRORS,
+    CAN_TELEM_SYNC,
     CAN_TELEM_NUM
 };
 
@@ -150,6 +160,17 @@ typedef struct {
     uint8_t doc;
 } canPacket_t;
 
+typedef struct {
+    uint32_t id;
+    uint32_t data[2];
+} canRxFrame_t;
+
+typedef struct {
+    uint32_t tir;
+    uint32_t tdtr;
+    uint32_t data[2];
+} canTxFrame_t;
+
 typedef struct {
     unsigned int value1 : 10;
     unsigned int value2 : 10;
@@ -186,14 +207,72 @@ typedef struct {
     unsigned int errCode :  3;
 } __attribute__((packed)) esc32CanStatus_t;
 
+typedef struct {
+    uint8_t state;
+    uint8_t runMode;
+    uint8_t inputMode;
+    uint8_t disarmReason;
+} __attribute__((packed)) esc32CanState_t;
+
+typedef struct {
+    uint16_t batVolts;	    // x 100
+    uint16_t motorVolts;    // x 100
+} __attribute__((packed)) esc32CanVin_t;
+
+typedef struct {
+    uint16_t avgAmps;	    // x 100
+    uint16_t maxAmps;	    // x 100
+} __attribute__((packed)) esc32CanAmps_t;
+
+typedef struct {
+    uint16_t rpm;
+    uint16_t targetRpm;
+    uint16_t duty;	    // x 100
+} __attribute__((packed)) esc32CanRpm_t;
+
+typedef struct {
+    uint32_t badDetects;
+    uint16_t failedStarts;
+    uint16_t canLost;	    // CAN frames dropped, either direction
+} __attribute__((packed)) esc32CanErrors_t;
+
+typedef struct {
+    int16_t error;	    // us, last offset change
+    uint16_t maxError;	    // us
+    uint16_t syncs;
+    uint8_t locked;
+    uint8_t late;	    // setpoints that arrived after their apply time
+} __attribute__((packed)) esc32CanSync_t;
+
 typedef struct {
     uint32_t validMicros;
     uint32_t uuid;
-    uint32_t mailboxFull;
+    uint32_t txDropped[CAN_TX_PRIORITIES];  // software queue full, by LCC
+    uint8_t txQueueMax[CAN_TX_PRIORITIES];  // deepest the queue has been, by LCC
     uint32_t packetsReceived;
+    uint32_t rxDropped;			    // software queue full
+    uint32_t rxOverruns;		    // hardware FIFO overrun
     uint8_t paramName[16];
-    uint16_t telemRate;
+    uint16_t telemRate;			    // for values without their own rate
     uint8_t telemValues[CAN_TELEM_NUM];
+    uint16_t telemRates[CAN_TELEM_NUM];
+    uint16_t telemDivs[CAN_TELEM_NUM];
+    uint32_t syncRxTicks;		    // local time the last sync frame arrived
+    uint32_t syncOffset;		    // master time - local time, timer ticks
+    int32_t syncError;			    // us
+    uint32_t syncMaxError;		    // us
+    uint16_t syncCount;
+    uint16_t syncLate;
+    uint8_t syncSeq;
+    uint8_t syncValid;
+    uint8_t syncLocked;
+    uint8_t syncMode;			    // 1 == hold setpoints for SYNC_APPLY
+    volatile uint32_t syncStaged;	    // doc<<16 | setpoint, 0 == nothing staged
+    volatile uint8_t syncPending;	    // due, but left for canProcess()
+    volatile uint32_t syncPrepared;	    // staged setpoint the values below are for, 0 == none
+    int32_t syncDuty;			    // OPEN_LOOP
+    float syncRpm;			    // closed loop target
+    uint8_t syncRunMode;
     uint8_t networkId;
     uint8_t groupId;
     uint8_t subGroupId;
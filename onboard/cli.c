@@ -17,6 +17,7 @@
 */
 
 #include "cli.h"
+#include "clifmt.h"
 #include "getbuildnum.h"
 #include "main.h"
 #include "serial.h"
@@ -26,6 +27,7 @@
 #include "pwm.h"
 #include "config.h"
 #include "rcc.h"
+#include "binary.h"
 #include "timer.h"
 #include "can.h"
 #include <stdio.h>
@@ -38,6 +40,7 @@ char cliBuf[32];
 char tempBuf[64];
 int cliBufIndex;
 int cliTelemetry;
+uint32_t cliStatusCycles;
 
 // this table must be sorted by command name
 const cliCommand_t cliCommandTable[] = {
@@ -52,6 +55,7 @@ const cliCommand_t cliCommandTable[] = {
     {"input", "[PWM | UART | I2C | CAN]", cliFuncInput},
     {"mode", "[OPEN_LOOP | RPM | THRUST | SERVO]", cliFuncMode},
     {"pos", "<degrees>", cliFuncPos},
+    {"profile", "[<segment> <ms> <volts start> <volts end> <period start> <period end> <exit detects>]", cliFuncProfile},
     {"pwm", "<microseconds>", cliFuncPwm},
     {"rpm", "<target>", cliFuncRpm},
     {"set", "LIST | [<PARAMETER> <value>]", cliFuncSet},
@@ -105,7 +109,7 @@ void cliUsage(cliCommand_t *cmd) {
 void cliFuncChangeInput(uint8_t input) {
     if (inputMode != input) {
 	inputMode = input;
-	sprintf(tempBuf, "Input mode set to %s\r\n", cliInputModes[input]);
+	cliSprintf(tempBuf, "Input mode set to %s\r\n", cliInputModes[input]);
 	serialPrint(tempBuf);
     }
 }
@@ -217,7 +221,7 @@ void cliFuncDuty(void *cmd, char *cmdLine) {
 	    serialPrint("duty out of range: 0 => 100\r\n");
 	}
 	else {
-	    sprintf(tempBuf, "Fet duty set to %.2f%%\r\n", (float)fetDutyCycle/fetPeriod*100.0f);
+	    cliSprintf(tempBuf, "Fet duty set to %.2f%%\r\n", (float)fetDutyCycle/FET_DUTY_PERIOD*100.0f);
 	    serialPrint(tempBuf);
 	}
     }
@@ -274,7 +278,7 @@ void cliFuncMode(void *cmd, char *cmdLine) {
 	if (i < (sizeof cliRunModes / sizeof cliRunModes[0])) {
 	    cliFuncDisarm(cmd, cmdLine);
 	    runMode = i;
-	    sprintf(tempBuf, "Run mode set to %s\r\n", cliRunModes[i]);
+	    cliSprintf(tempBuf, "Run mode set to %s\r\n", cliRunModes[i]);
 	    serialPrint(tempBuf);
 	}
 	else
@@ -297,12 +301,56 @@ void cliFuncPos(void *cmd, char *cmdLine) {
 	}
 	else {
 	    fetSetAngle(angle);
-	    sprintf(tempBuf, "Position set to %.1f\r\n", angle);
+	    cliSprintf(tempBuf, "Position set to %.1f\r\n", angle);
 	    serialPrint(tempBuf);
 	}
     }
 }
 
+void cliFuncProfile(void *cmd, char *cmdLine) {
+    fetStartSegment_t *s;
+    int seg, ms, p0, p1, exitDetects;
+    float v0, v1;
+    int i;
+
+    if (sscanf(cmdLine, "%d %d %f %f %d %d %d", &seg, &ms, &v0, &v1, &p0, &p1, &exitDetects) == 7) {
+	if (state > ESC_STATE_STOPPED) {
+	    serialPrint(stopError);
+	}
+	else if (seg < 0 || seg >= FET_START_SEGMENTS) {
+	    cliSprintf(tempBuf, "segment out of range: 0 => %d\r\n", FET_START_SEGMENTS-1);
+	    serialPrint(tempBuf);
+	}
+	else if (ms < 0 || ms > 0xffff || p0 < 0 || p0 > ADC_MAX_MAX_PERIOD || p1 < 0 || p1 > ADC_MAX_MAX_PERIOD) {
+	    serialPrint("time or period out of range\r\n");
+	}
+	else if (v0 < 0.0f || v0 > FET_MAX_START_VOLTAGE || v1 < 0.0f || v1 > FET_MAX_START_VOLTAGE) {
+	    serialPrint("voltage out of range\r\n");
+	}
+	else {
+	    s = &fetStartProfile[seg];
+	    s->ms = ms;
+	    s->volts[0] = v0;
+	    s->volts[1] = v1;
+	    s->period[0] = p0;
+	    s->period[1] = p0 ? p1 : 0;
+	    s->exitDetects = exitDetects > 0 ? exitDetects : 0;
+	}
+    }
+    else if (*cmdLine) {
+	cliUsage((cliCommand_t *)cmd);
+	return;
+    }
+
+    // list profile
+    serialPrint("SEG      MS   VOLTS  ->VOLTS  PERIOD ->PERIOD    EXIT\r\n");
+    for (i = 0; i < FET_START_SEGMENTS && fetStartProfile[i].ms; i++) {
+	s = &fetStartProfile[i];
+	cliSprintf(tempBuf, "%3d%8d%8.2f%8.2f%8d%8d%8d\r\n", i, s->ms, s->volts[0], s->volts[1], s->period[0], s->period[1], s->exitDetects);
+	serialPrint(tempBuf);
+    }
+}
+
 void cliFuncPwm(void *cmd, char *cmdLine) {
     uint16_t pwm;
 
@@ -314,14 +362,14 @@ void cliFuncPwm(void *cmd, char *cmdLine) {
 	    cliUsage((cliCommand_t *)cmd);
 	}
 	else if (pwm < pwmLoValue || pwm > pwmHiValue) {
-	    sprintf(tempBuf, "PWM out of range: %d => %d\r\n", pwmLoValue, pwmHiValue);
+	    cliSprintf(tempBuf, "PWM out of range: %d => %d\r\n", pwmLoValue, pwmHiValue);
 	    serialPrint(tempBuf);
 	}
 	else {
 	    if (runMode != SERVO_MODE)
 		runMode = OPEN_LOOP;
 	    runNewInput(pwm);
-	    sprintf(tempBuf, "PWM set to %d\r\n", pwm);
+	    cliSprintf(tempBuf, "PWM set to %d\r\n", pwm);
 	    serialPrint(tempBuf);
 	}
     }
@@ -349,7 +397,7 @@ void cliFuncRpm(void *cmd, char *cmdLine) {
 		runMode = CLOSED_LOOP_RPM;
 	    }
 	    targetRpm = target;
-	    sprintf(tempBuf, "RPM set to %6.0f\r\n", target);
+	    cliSprintf(tempBuf, "RPM set to %6.0f\r\n", target);
 	    serialPrint(tempBuf);
 	}
     }
@@ -358,9 +406,9 @@ void cliFuncRpm(void *cmd, char *cmdLine) {
 void cliPrintParam(int i) {
     const char *format = "%-20s = ";
 
-    sprintf(tempBuf, format, configParameterStrings[i]);
+    cliSprintf(tempBuf, format, configParameterStrings[i]);
     serialPrint(tempBuf);
-    sprintf(tempBuf, configFormatStrings[i], p[i]);
+    cliSprintf(tempBuf, configFormatStrings[i], p[i]);
     serialPrint(tempBuf);
     serialPrint("\r\n");
 }
@@ -382,13 +430,13 @@ void cliFuncSet(void *cmd, char *cmdLine) {
 	    i = configGetId(param);
 
 	    if (i < 0) {
-		sprintf(tempBuf, "SET: no such parameter '%s'\r\n", param);
+		cliSprintf(tempBuf, "SET: no such parameter '%s'\r\n", param);
 		serialPrint(tempBuf);
 	    }
 	    else {
 		if (sscanf(cmdLine + strlen(param)+1, "%f", &value) == 1) {
 		    if (state > ESC_STATE_STOPPED) {
-			sprintf(tempBuf, stopError);
+			cliSprintf(tempBuf, stopError);
 			serialPrint(tempBuf);
 		    }
 		    else {
@@ -423,48 +471,73 @@ void cliFuncStatus(void *cmd, char *cmdLine) {
     const char *formatString = "%-12s%10s\r\n";
     float duty;
 
-    duty = (float)fetActualDutyCycle/fetPeriod;
+    duty = (float)fetActualDutyCycle/FET_DUTY_PERIOD;
 
-    sprintf(tempBuf, formatString, "INPUT MODE", cliInputModes[inputMode]);
+    cliSprintf(tempBuf, formatString, "INPUT MODE", cliInputModes[inputMode]);
     serialPrint(tempBuf);
 
-    sprintf(tempBuf, formatString, "RUN MODE", cliRunModes[runMode]);
+    cliSprintf(tempBuf, formatString, "RUN MODE", cliRunModes[runMode]);
     serialPrint(tempBuf);
 
-    sprintf(tempBuf, formatString, "ESC STATE", cliStates[state]);
+    cliSprintf(tempBuf, formatString, "ESC STATE", cliStates[state]);
     serialPrint(tempBuf);
 
-    sprintf(tempBuf, formatFloat, "PERCENT IDLE", idlePercent);
+    cliSprintf(tempBuf, formatFloat, "PERCENT IDLE", idlePercent);
     serialPrint(tempBuf);
 
-    sprintf(tempBuf, formatFloat, "COMM PERIOD", (float)(crossingPeriod/TIMER_MULT));
+    cliSprintf(tempBuf, formatFloat, "COMM PERIOD", (float)(crossingPeriod/TIMER_MULT));
     serialPrint(tempBuf);
 
-    sprintf(tempBuf, formatInt, "BAD DETECTS", fetTotalBadDetects);
+    cliSprintf(tempBuf, formatInt, "BAD DETECTS", fetTotalBadDetects);
     serialPrint(tempBuf);
 
-    sprintf(tempBuf, formatFloat, "FET DUTY", duty*100.0f);
+    cliSprintf(tempBuf, formatFloat, "FET DUTY", duty*100.0f);
     serialPrint(tempBuf);
 
-    sprintf(tempBuf, formatFloat, "RPM", rpm);
+    cliSprintf(tempBuf, formatFloat, "SWITCH KHZ", (float)FET_AHB_FREQ/fetPeriod/2000.0f);
     serialPrint(tempBuf);
 
-    sprintf(tempBuf, formatFloat, "AMPS AVG", avgAmps);
+    cliSprintf(tempBuf, formatFloat, "RPM", rpm);
     serialPrint(tempBuf);
 
-    sprintf(tempBuf, formatFloat, "AMPS MAX", maxAmps);
+    cliSprintf(tempBuf, formatFloat, "AMPS AVG", avgAmps);
     serialPrint(tempBuf);
 
-    sprintf(tempBuf, formatFloat, "BAT VOLTS", avgVolts);
+    cliSprintf(tempBuf, formatFloat, "AMPS MAX", maxAmps);
     serialPrint(tempBuf);
 
-    sprintf(tempBuf, formatFloat, "MOTOR VOLTS", avgVolts*duty);
+    cliSprintf(tempBuf, formatFloat, "BAT VOLTS", avgVolts);
     serialPrint(tempBuf);
 
+    cliSprintf(tempBuf, formatFloat, "MOTOR VOLTS", avgVolts*duty);
+    serialPrint(tempBuf);
+
+    cliSprintf(tempBuf, formatFloat, "START MS", runStartTime / 1000.0f);
+    serialPrint(tempBuf);
+
+    cliSprintf(tempBuf, formatFloat, "1ST DET MS", runFirstDetectTime / 1000.0f);
+    serialPrint(tempBuf);
+
+    cliSprintf(tempBuf, formatInt, "FAILED START", runFailedStarts);
+    serialPrint(tempBuf);
+
+    cliSprintf(tempBuf, formatFloat, "TIMER LATE", (float)timerEventMaxLate / TIMER_MULT);
+    serialPrint(tempBuf);
+
+    cliSprintf(tempBuf, formatInt, "CMD LATENCY", binaryCmdMaxLatency);
+    serialPrint(tempBuf);
+
+    if (p[BIDIRECTIONAL]) {
+	cliSprintf(tempBuf, formatFloat, "REVERSE MS", runReverseTime / 1000.0f);
+	serialPrint(tempBuf);
+    }
+
 #ifdef ESC_DEBUG
-    sprintf(tempBuf, formatInt, "DISARM CODE", disarmReason);
+    cliSprintf(tempBuf, formatInt, "DISARM CODE", disarmReason);
+    serialPrint(tempBuf);
+    cliSprintf(tempBuf, formatInt, "CAN NET ID", canData.networkId);
     serialPrint(tempBuf);
-    sprintf(tempBuf, formatInt, "CAN NET ID", canData.networkId);
+    cliSprintf(tempBuf, formatInt, "STEP CYCLES", fetStepCycles);
     serialPrint(tempBuf);
 #endif
 }
@@ -502,7 +575,7 @@ void cliFuncTelemetry(void *cmd, char *cmdLine) {
 }
 
 void cliFuncVer(void *cmd, char *cmdLine) {
-    sprintf(tempBuf, "ESC32 ver %s\r\n", version);
+    cliSprintf(tempBuf, "ESC32 ver %s\r\n", version);
     serialPrint(tempBuf);
 }
 
@@ -541,15 +614,20 @@ void cliCheck(void) {
     cliCommand_t *cmd = NULL;
 
     if (cliTelemetry && !(runCount % cliTelemetry)) {
+	uint32_t cycles = FET_CYCLE_COUNTER;
+
 	maxAmps = (adcMaxAmps - adcAmpsOffset) * adcToAmps;
 
 	serialPrint(cliHome);
-	sprintf(tempBuf, "Telemetry @ %d Hz\r\n\n", RUN_FREQ/cliTelemetry);
+	// cycles taken by the previous refresh
+	cliSprintf(tempBuf, "Telemetry @ %d Hz, %u cycles\r\n\n", RUN_FREQ/cliTelemetry, cliStatusCycles);
 	serialPrint(tempBuf);
 	cliFuncStatus(cmd, "");
 	serialPrint("\n> ");
 	serialPrint(cliBuf);
 	serialPrint(cliClearEOL);
+
+	cliStatusCycles = FET_CYCLE_COUNTER - cycles;
     }
 
     while (serialAvailable()) {
@@ -631,7 +709,7 @@ void cliCheck(void) {
 void cliInit(void) {
     serialPrint(cliHome);
     serialPrint(cliClear);
-    sprintf(version, "%s.%d", VERSION, getBuildNumber());
+    cliSprintf(version, "%s.%d", VERSION, getBuildNumber());
 
     cliFuncVer(0, 0);
     serialPrint("\r\nCLI ready.\r\n");
@@ -45,6 +45,7 @@ extern void cliFuncHelp(void *cmd, char *cmdLine);
 extern void cliFuncInput(void *cmd, char *cmdLine);
 extern void cliFuncMode(void *cmd, char *cmdLine);
 extern void cliFuncPos(void *cmd, char *cmdLine);
+extern void cliFuncProfile(void *cmd, char *cmdLine);
 extern void cliFuncPwm(void *cmd, char *cmdLine);
 extern void cliFuncRpm(void *cmd, char *cmdLine);
 extern void cliFuncSet(void *cmd, char *cmdLine);
@@ -0,0 +1,272 @@
+/*
+    This file is part of AutoQuad ESC32.
+
+    AutoQuad ESC32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AutoQuad ESC32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License
+    along with AutoQuad ESC32.  If not, see <http://www.gnu.org/licenses/>.
+
+    Copyright © 2011, 2012, 2013  Bill Nesbitt
+*/
+
+#include "clifmt.h"
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+
+static const uint32_t cliPow10[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+static const double cliPow10d[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static char *cliFmtUint(char *s, uint32_t v, int digits) {
+    char tmp[10];
+    int n = 0;
+
+    do {
+	tmp[n++] = '0' + v % 10;
+	v /= 10;
+    } while (v || n < digits);
+
+    while (n)
+	*s++ = tmp[--n];
+
+    return s;
+}
+
+// Fixed point, f must be positive and fit in 32 bits.  The fraction is
+// exactly M / 2^E, so it is scaled and rounded (half to even, like libc)
+// in 64 bit integers.
+static char *cliFmtFixed(char *s, float f, int prec) {
+    uint64_t prod, rem, half;
+    uint32_t i, frac;
+    float r;
+    int e;
+
+    i = (uint32_t)f;
+    r = f - (float)i;
+    frac = 0;
+
+    if (r != 0.0f) {
+	r = frexpf(r, &e);
+	e = 24 - e;
+
+	prod = (uint64_t)(uint32_t)ldexpf(r, 24) * cliPow10[prec];
+
+	if (e < 64) {
+	    half = (uint64_t)1 << (e - 1);
+	    frac = prod >> e;
+	    rem = prod - ((uint64_t)frac << e);
+
+	    if (rem > half || (rem == half && ((prec ? frac : i) & 1)))
+		frac++;
+	}
+    }
+
+    if (frac >= cliPow10[prec]) {
+	frac -= cliPow10[prec];
+	i++;
+    }
+
+    s = cliFmtUint(s, i, 1);
+    if (prec) {
+	*s++ = '.';
+	s = cliFmtUint(s, frac, prec);
+    }
+
+    return s;
+}
+
+// d * 10^k, each step by an exactly representable power of ten
+static double cliScale(double d, int k) {
+    while (k > 22) {
+	d *= 1e22;
+	k -= 22;
+    }
+    while (k < -22) {
+	d /= 1e22;
+	k += 22;
+    }
+
+    return (k >= 0) ? d * cliPow10d[k] : d / cliPow10d[-k];
+}
+
+// Exponent form.  The decimal exponent is estimated from the
+// binary one, then the value is scaled to prec + 1 digits in one go and
+// rounded half to even.  Repeated * 10 / * 0.1 in float loses the last digit.
+static char *cliFmtExp(char *s, float f, int prec) {
+    uint32_t m = 0;
+    double d, r;
+    int exp = 0;
+    int e;
+
+    // prec + 1 digits must fit in 32 bits
+    if (prec > 8)
+	prec = 8;
+
+    if (f != 0.0f) {
+	frexpf(f, &e);
+
+	// floor((e - 1) * log10(2))
+	e = (e - 1) * 1233;
+	exp = (e >= 0) ? e / 4096 : -((-e + 4095) / 4096);
+
+	for (;;) {
+	    d = cliScale(f, prec - exp);
+	    m = (uint32_t)d;
+	    r = d - m;
+	    if (r > 0.5 || (r == 0.5 && (m & 1)))
+		m++;
+
+	    if (m >= cliPow10[prec + 1])
+		exp++;
+	    else if (m < cliPow10[prec])
+		exp--;
+	    else
+		break;
+	}
+    }
+
+    s = cliFmtUint(s, m / cliPow10[prec], 1);
+    if (prec) {
+	*s++ = '.';
+	s = cliFmtUint(s, m % cliPow10[prec], prec);
+    }
+
+    *s++ = 'e';
+    if (exp < 0) {
+	*s++ = '-';
+	exp = -exp;
+    }
+    else {
+	*s++ = '+';
+    }
+
+    return cliFmtUint(s, exp, 2);
+}
+
+// Replaces sprintf on the CLI paths.  Understands the subset of printf the
+// CLI and config format strings use: flags '-' and '+', width, precision and
+// %d %u %s %f %e %%.
+int cliSprintf(char *buf, const char *fmt, ...) {
+    va_list ap;
+    char num[24];
+    const char *str;
+    char *s = buf;
+    char *n;
+    int left, plus, width, prec, len;
+    int i;
+    float f;
+
+    va_start(ap, fmt);
+    while (*fmt) {
+	if (*fmt != '%') {
+	    *s++ = *fmt++;
+	    continue;
+	}
+	fmt++;
+
+	left = plus = 0;
+	for (;; fmt++) {
+	    if (*fmt == '-')
+		left = 1;
+	    else if (*fmt == '+')
+		plus = 1;
+	    else
+		break;
+	}
+
+	width = 0;
+	while (*fmt >= '0' && *fmt <= '9')
+	    width = width*10 + *fmt++ - '0';
+
+	prec = -1;
+	if (*fmt == '.') {
+	    prec = 0;
+	    fmt++;
+	    while (*fmt >= '0' && *fmt <= '9')
+		prec = prec*10 + *fmt++ - '0';
+	}
+
+	str = n = num;
+	switch (*fmt++) {
+	case 'd':
+	    i = va_arg(ap, int);
+	    if (i < 0)
+		*n++ = '-';
+	    else if (plus)
+		*n++ = '+';
+	    n = cliFmtUint(n, (i < 0) ? -(uint32_t)i : (uint32_t)i, 1);
+	    break;
+
+	case 'u':
+	    n = cliFmtUint(n, va_arg(ap, unsigned int), 1);
+	    break;
+
+	case 'f':
+	case 'e':
+	    f = (float)va_arg(ap, double);
+	    if (prec < 0)
+		prec = 6;
+	    else if (prec > CLI_FMT_MAX_PREC)
+		prec = CLI_FMT_MAX_PREC;
+
+	    if (f < 0.0f) {
+		*n++ = '-';
+		f = -f;
+	    }
+	    else if (plus) {
+		*n++ = '+';
+	    }
+
+	    if (isnan(f)) {
+		memcpy(n, "nan", 3);
+		n += 3;
+	    }
+	    else if (isinf(f)) {
+		memcpy(n, "inf", 3);
+		n += 3;
+	    }
+	    // too big for fixed point, fall back to exponent
+	    else if (fmt[-1] == 'e' || f >= 4e9f)
+		n = cliFmtExp(n, f, prec);
+	    else
+		n = cliFmtFixed(n, f, prec);
+	    break;
+
+	case 's':
+	    str = va_arg(ap, const char *);
+	    n = (char *)str + strlen(str);
+	    break;
+
+	case '%':
+	    *n++ = '%';
+	    break;
+
+	default:
+	    fmt--;
+	    continue;
+	}
+
+	len = n - str;
+	if (!left)
+	    for (; width > len; width--)
+		*s++ = ' ';
+	while (str < n)
+	    *s++ = *str++;
+	for (; width > len; width--)
+	    *s++ = ' ';
+    }
+    va_end(ap);
+
+    *s = 0;
+
+    return s - buf;
+}
+
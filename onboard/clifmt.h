@@ -0,0 +1,28 @@
+/*
+    This file is part of AutoQuad ESC32.
+
+    AutoQuad ESC32 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    AutoQuad ESC32 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License
+    along with AutoQuad ESC32.  If not, see <http://www.gnu.org/licenses/>.
+
+    Copyright © 2011, 2012, 2013  Bill Nesbitt
+*/
+
+#ifndef _CLIFMT_H
+#define _CLIFMT_H
+
+#include <stdint.h>
+
+#define CLI_FMT_MAX_PREC    9
+
+extern int cliSprintf(char *buf, const char *fmt, ...);
+
+#endif
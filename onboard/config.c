@@ -80,7 +80,14 @@ const char *configParameterStrings[] = {
     "SERVO_MAX_RATE",
     "SERVO_SCALE",
     "ESC_ID",
-    "DIRECTION"
+    "DIRECTION",
+    "SWITCH_FREQ_MIN",
+    "SWITCH_FREQ_DUTY",
+    "START_SENSE",
+    "START_SENSE_MICROS",
+    "START_CATCH",
+    "BIDIRECTIONAL",
+    "BIDIR_DEADBAND"
 };
 
 const char *configFormatStrings[] = {
@@ -133,7 +140,14 @@ const char *configFormatStrings[] = {
     "%.1f deg/s",   // SERVO_MAX_RATE
     "%.1f deg",	    // SERVO_SCALE
     "%.0f",	    // ESC_ID
-    "%.0f"	    // DIRECTION
+    "%.0f",	    // DIRECTION
+    "%.1f KHz",	    // SWITCH_FREQ_MIN
+    "%.0f %%",	    // SWITCH_FREQ_DUTY
+    "%.0f",	    // START_SENSE
+    "%.0f us",	    // START_SENSE_MICROS
+    "%.0f",	    // START_CATCH
+    "%.0f",	    // BIDIRECTIONAL
+    "%.0f us"	    // BIDIR_DEADBAND
 };
 
 void configInit(void) {
@@ -261,6 +275,13 @@ void configLoadDefault(void) {
     p[SERVO_SCALE] = DEFAULT_SERVO_SCALE;
     p[ESC_ID] = DEFAULT_ESC_ID;
     p[DIRECTION] = DEFAULT_DIRECTION;
+    p[SWITCH_FREQ_MIN] = DEFAULT_SWITCH_FREQ_MIN;
+    p[SWITCH_FREQ_DUTY] = DEFAULT_SWITCH_FREQ_DUTY;
+    p[START_SENSE] = DEFAULT_START_SENSE;
+    p[START_SENSE_MICROS] = DEFAULT_START_SENSE_MICROS;
+    p[START_CATCH] = DEFAULT_START_CATCH;
+    p[BIDIRECTIONAL] = DEFAULT_BIDIRECTIONAL;
+    p[BIDIR_DEADBAND] = DEFAULT_BIDIR_DEADBAND;
 
     configRecalcConst();
 }
@@ -19,7 +19,7 @@
 #ifndef _CONFIG_H
 #define _CONFIG_H
 
-#define DEFAULT_CONFIG_VERSION		2.01f
+#define DEFAULT_CONFIG_VERSION		2.06f
 #define DEFAULT_STARTUP_MODE		0.0f
 #define DEFAULT_BAUD_RATE		230400
 #define DEFAULT_ESC_ID			0
@@ -80,6 +80,13 @@
 #define DEFAULT_SERVO_MAX_RATE		1000.0f	    // deg/s
 #define DEFAULT_SERVO_SCALE		360.0f	    // deg
 #define DEFAULT_DIRECTION		1.0f	    // 1 == forward, -1 == reverse
+#define DEFAULT_SWITCH_FREQ_MIN		0.0f	    // lowest scheduled PWM frequency in KHz (0 = fixed SWITCH_FREQ)
+#define DEFAULT_SWITCH_FREQ_DUTY	80.0f	    // duty at which SWITCH_FREQ_MIN is reached
+#define DEFAULT_START_SENSE		0.0f	    // 1 == find rotor position by inductive sensing instead of aligning
+#define DEFAULT_START_SENSE_MICROS	20.0f	    // us sensing pulse width
+#define DEFAULT_START_CATCH		0.0f	    // 1 == listen for and sync to an already spinning rotor before starting
+#define DEFAULT_BIDIRECTIONAL		0.0f	    // 1 == setpoint sign selects direction, center of input range is stop
+#define DEFAULT_BIDIR_DEADBAND		25.0f	    // us either side of the PWM center that means stop
 
 #define FLASH_PAGE_SIZE			((uint16_t)0x400)
 #define FLASH_WRITE_ADDR		(0x08000000 + (uint32_t)FLASH_PAGE_SIZE * 63)    // use the last KB for storage
@@ -135,6 +142,13 @@ enum configParameters {
     SERVO_SCALE,
     ESC_ID,
     DIRECTION,
+    SWITCH_FREQ_MIN,
+    SWITCH_FREQ_DUTY,
+    START_SENSE,
+    START_SENSE_MICROS,
+    START_CATCH,
+    BIDIRECTIONAL,
+    BIDIR_DEADBAND,
     CONFIG_NUM_PARAMS
 };
 
@@ -53,11 +53,21 @@ uint32_t BL[7] = {BL_ON,  BL_ON,  BL_ON,  BL_OFF, BL_OFF, BL_OFF, BL_OFF};	// no
 uint32_t CH[7] = {  0,      0,      1,      1,      0,      0,      0};
 uint32_t CL[7] = {CL_OFF, CL_OFF, CL_OFF, CL_OFF, CL_OFF, CL_ON,  CL_ON};
 
+// [braking][step]
+fetStepPattern_t fetStepTable[2][7];
+// [direction][step] (0 == reverse, 1 == forward)
+int8_t fetNextStepTable[2][7];
+
 int32_t fetSwitchFreq;
 int32_t fetStartDuty;
 int16_t fetStartDetects;
 int16_t fetDisarmDetects;
-int32_t fetPeriod;
+int16_t fetSenseMicros;
+volatile int32_t fetPeriod;
+volatile int32_t fetNextPeriod;
+int32_t fetMaxPeriod;
+int32_t fetMinPeriod;
+float fetSwitchDuty;
 int32_t fetActualDutyCycle;
 volatile int32_t fetDutyCycle;
 volatile uint8_t fetStep;
@@ -68,8 +78,17 @@ volatile uint32_t fetTotalBadDetects;
 volatile uint32_t fetCommutationMicros;
 int8_t fetBrakingEnabled;
 int8_t fetBraking;
-int16_t startSeqCnt;
+fetStartSegment_t fetStartProfile[FET_START_SEGMENTS+1];
+int8_t fetStartSeg;
+int32_t fetStartSegTicks;
+int16_t fetStartSeqDetects;
 int8_t fetStepDir;
+volatile int8_t fetCatching;
+int8_t fetCatchStep;
+int16_t fetCatchDetects;
+volatile uint32_t fetStepCycles;
+volatile int32_t fetDitherDuty;
+int32_t fetDitherAccum;
 float fetServoAngle;
 float fetServoMaxRate;
 
@@ -82,12 +101,42 @@ void fetCreateSine(void) {
     for (i = 0; i < FET_SERVO_RESOLUTION; i++) {
 	a = M_PI * 2.0f * i / FET_SERVO_RESOLUTION;
 
-	// third order harmonic injection
-	fetSine[i] = (sinf(a) + sinf(a*3.0f)/6.0f) * (2.0f/sqrtf(3.0f)) * (float)fetPeriod / 2.0f;
+	// third order harmonic injection, scaled to 1/2^16 of fetPeriod
+	fetSine[i] = (sinf(a) + sinf(a*3.0f)/6.0f) * (2.0f/sqrtf(3.0f)) * 32767.0f;
+    }
+}
+
+void fetCreateStepTables(void) {
+    int i, b;
+
+    for (b = 0; b < 2; b++) {
+	for (i = 0; i < 7; i++) {
+	    fetStepTable[b][i].crl = (AH[i] ? AH_CRL_EN : 0) | (BH[i] ? BH_CRL_EN : 0);
+	    fetStepTable[b][i].ch = CH[i];
+
+	    // low side inverted PWM
+	    if (b) {
+		fetStepTable[b][i].crl |= BL_CRL_EN | CL_CRL_EN;
+		fetStepTable[b][i].al = 1;
+	    }
+	    else {
+		fetStepTable[b][i].al = 0;
+	    }
+
+	    fetStepTable[b][i].portA = AL[i];
+	    fetStepTable[b][i].portB = BL[i] | CL[i];
+	}
+    }
+
+    for (i = 0; i < 7; i++) {
+	fetNextStepTable[1][i] = (i >= 6) ? 1 : i + 1;
+	fetNextStepTable[0][i] = (i <= 1) ? 6 : i - 1;
     }
 }
 
 void _fetSetServoDuty(uint16_t duty[3]) {
+    *FET_DITHER_BITBAND = 0;
+
     FET_H_TIMER->FET_A_H_CHANNEL = duty[0];
     FET_H_TIMER->FET_B_H_CHANNEL = duty[1];
     FET_H_TIMER->FET_C_H_CHANNEL = duty[2];
@@ -131,13 +180,13 @@ void fetUpdateServo(void) {
 	    index += FET_SERVO_RESOLUTION;
 	index = index % FET_SERVO_RESOLUTION;
 
-	pwm[0] = fetPeriod/2 + fetSine[index] * p[SERVO_DUTY] / 100;
+	pwm[0] = fetPeriod/2 + ((fetSine[index] * fetPeriod)>>16) * p[SERVO_DUTY] / 100;
 
 	index = ((index + FET_SERVO_RESOLUTION / 3) % FET_SERVO_RESOLUTION);
-	pwm[1] = fetPeriod/2 + fetSine[index] * p[SERVO_DUTY] / 100;
+	pwm[1] = fetPeriod/2 + ((fetSine[index] * fetPeriod)>>16) * p[SERVO_DUTY] / 100;
 
 	index = ((index + FET_SERVO_RESOLUTION / 3) % FET_SERVO_RESOLUTION);
-	pwm[2] = fetPeriod/2 + fetSine[index] * p[SERVO_DUTY] / 100;
+	pwm[2] = fetPeriod/2 + ((fetSine[index] * fetPeriod)>>16) * p[SERVO_DUTY] / 100;
 
 	_fetSetServoDuty(pwm);
     }
@@ -162,14 +211,32 @@ void fetSetAngle(float angle) {
 
 #define FET_TEST_DELAY	1000
 
-uint8_t fetSelfTest(void) {
-    int32_t baseCurrent;
-    int32_t cl1, cl2, cl3;
-    int32_t ch1, ch2, ch3;
+timerTask_t fetSelfTestTask;
+uint8_t fetSelfTestResult;
 
-    // must be disarmed to run self test
-    if (state != ESC_STATE_DISARMED)
-	return FET_TEST_NOT_RUN;
+static void fetSelfTestOff(void) {
+    FET_A_L_OFF;
+    FET_B_L_OFF;
+    FET_C_L_OFF;
+
+    FET_A_H_OFF;
+    FET_B_H_OFF;
+    FET_C_H_OFF;
+
+    *AL_BITBAND = 0;
+    *BL_BITBAND = 0;
+    *CL_BITBAND = 0;
+
+    _fetSetDutyCycle(0);
+    fetSetStep(0);
+}
+
+static void fetSelfTestRun(int unused) {
+    static int32_t baseCurrent;
+    static int32_t cl1, cl2, cl3;
+    static int32_t ch1, ch2, ch3;
+
+    TIMER_TASK_BEGIN(&fetSelfTestTask);
 
     fetSetStep(0);
 
@@ -183,7 +250,7 @@ uint8_t fetSelfTest(void) {
     FET_C_H_OFF;
 
     // record base current
-    timerDelay(FET_TEST_DELAY);
+    TIMER_TASK_DELAY(&fetSelfTestTask, FET_TEST_DELAY);
     baseCurrent = adcAvgAmps;
 
     // manually set HI output duty cycle (1/16th power)
@@ -196,28 +263,28 @@ uint8_t fetSelfTest(void) {
     FET_B_L_ON;
     FET_C_L_ON;
 
-    timerDelay(FET_TEST_DELAY*10);
+    TIMER_TASK_DELAY(&fetSelfTestTask, FET_TEST_DELAY*10);
 
     // Phase A hi FET
     *AH_BITBAND = 1;
-    timerDelay(FET_TEST_DELAY);
+    TIMER_TASK_DELAY(&fetSelfTestTask, FET_TEST_DELAY);
     ch1 = (adcAvgAmps - baseCurrent)>>ADC_AMPS_PRECISION;
     *AH_BITBAND = 0;
-    timerDelay(FET_TEST_DELAY*10);
+    TIMER_TASK_DELAY(&fetSelfTestTask, FET_TEST_DELAY*10);
 
     // Phase B hi FET
     *BH_BITBAND = 1;
-    timerDelay(FET_TEST_DELAY);
+    TIMER_TASK_DELAY(&fetSelfTestTask, FET_TEST_DELAY);
     ch2 = (adcAvgAmps - baseCurrent)>>ADC_AMPS_PRECISION;
     *BH_BITBAND = 0;
-    timerDelay(FET_TEST_DELAY*10);
+    TIMER_TASK_DELAY(&fetSelfTestTask, FET_TEST_DELAY*10);
 
     // Phase C hi FET
     *CH_BITBAND = 1;
-    timerDelay(FET_TEST_DELAY);
+    TIMER_TASK_DELAY(&fetSelfTestTask, FET_TEST_DELAY);
     ch3 = (adcAvgAmps - baseCurrent)>>ADC_AMPS_PRECISION;
     *CH_BITBAND = 0;
-    timerDelay(FET_TEST_DELAY*10);
+    TIMER_TASK_DELAY(&fetSelfTestTask, FET_TEST_DELAY*10);
 
     // all lows off
     FET_A_L_OFF;
@@ -233,102 +300,156 @@ uint8_t fetSelfTest(void) {
     *BL_BITBAND = 0;
     *CL_BITBAND = 0;
 
-    timerDelay(FET_TEST_DELAY*10);
+    TIMER_TASK_DELAY(&fetSelfTestTask, FET_TEST_DELAY*10);
 
     // all highs on
     FET_A_H_ON;
     FET_B_H_ON;
     FET_C_H_ON;
 
-    timerDelay(FET_TEST_DELAY*10);
+    TIMER_TASK_DELAY(&fetSelfTestTask, FET_TEST_DELAY*10);
 
     // Phase A lo FET
     *AL_BITBAND = 1;
-    timerDelay(FET_TEST_DELAY);
+    TIMER_TASK_DELAY(&fetSelfTestTask, FET_TEST_DELAY);
     cl1 = (adcAvgAmps - baseCurrent)>>ADC_AMPS_PRECISION;
     *AL_BITBAND = 0;
-    timerDelay(FET_TEST_DELAY*10);
+    TIMER_TASK_DELAY(&fetSelfTestTask, FET_TEST_DELAY*10);
 
     // Phase B lo FET
     *BL_BITBAND = 1;
-    timerDelay(FET_TEST_DELAY);
+    TIMER_TASK_DELAY(&fetSelfTestTask, FET_TEST_DELAY);
     cl2 = (adcAvgAmps - baseCurrent)>>ADC_AMPS_PRECISION;
     *BL_BITBAND = 0;
-    timerDelay(FET_TEST_DELAY*10);
+    TIMER_TASK_DELAY(&fetSelfTestTask, FET_TEST_DELAY*10);
 
     // Phase C lo FET
     *CL_BITBAND = 1;
-    timerDelay(FET_TEST_DELAY);
+    TIMER_TASK_DELAY(&fetSelfTestTask, FET_TEST_DELAY);
     cl3 = (adcAvgAmps - baseCurrent)>>ADC_AMPS_PRECISION;
     *CL_BITBAND = 0;
-    timerDelay(FET_TEST_DELAY*10);
+    TIMER_TASK_DELAY(&fetSelfTestTask, FET_TEST_DELAY*10);
 
     // shut everything off
-    FET_A_L_OFF;
-    FET_B_L_OFF;
-    FET_C_L_OFF;
+    fetSelfTestOff();
 
-    FET_A_H_OFF;
-    FET_B_H_OFF;
-    FET_C_H_OFF;
+    if (cl1 < 50)
+	fetSelfTestResult = FET_TEST_A_LO_FAIL;
+    else if (cl2 < 50)
+	fetSelfTestResult = FET_TEST_B_LO_FAIL;
+    else if (cl3 < 50)
+	fetSelfTestResult = FET_TEST_C_LO_FAIL;
+    else if (ch1 < 50)
+	fetSelfTestResult = FET_TEST_A_HI_FAIL;
+    else if (ch2 < 50)
+	fetSelfTestResult = FET_TEST_B_HI_FAIL;
+    else if (ch3 < 50)
+	fetSelfTestResult = FET_TEST_C_HI_FAIL;
+    else
+	fetSelfTestResult = FET_TEST_PASSED;
 
-    *AL_BITBAND = 0;
-    *BL_BITBAND = 0;
-    *CL_BITBAND = 0;
+    TIMER_TASK_END(&fetSelfTestTask);
 
-    _fetSetDutyCycle(0);
-    fetSetStep(0);
+    // no alarm for the next step
+    fetSelfTestOff();
+    fetSelfTestResult = FET_TEST_NOT_RUN;
+}
 
-    if (cl1 < 50)
-	return FET_TEST_A_LO_FAIL;
-    if (cl2 < 50)
-	return FET_TEST_B_LO_FAIL;
-    if (cl3 < 50)
-	return FET_TEST_C_LO_FAIL;
-    if (ch1 < 50)
-	return FET_TEST_A_HI_FAIL;
-    if (ch2 < 50)
-	return FET_TEST_B_HI_FAIL;
-    if (ch3 < 50)
-	return FET_TEST_C_HI_FAIL;
+// starts the self test in the background, outcome in fetSelfTestResult
+uint8_t fetSelfTest(void) {
+    // must be disarmed to run self test
+    if (state != ESC_STATE_DISARMED || timerTaskBusy(&fetSelfTestTask))
+	return FET_TEST_NOT_RUN;
 
-    return FET_TEST_PASSED;
+    fetSelfTestResult = FET_TEST_RUNNING;
+    timerTaskStart(&fetSelfTestTask, fetSelfTestRun, 0);
+
+    return FET_TEST_RUNNING;
 }
 
+timerTask_t fetBeepTask;
+fetBeepNote_t fetBeepQueue[FET_BEEP_QUEUE];
+volatile uint8_t fetBeepHead, fetBeepTail;
+volatile uint8_t fetBeeping;
+
+// plays queued notes, a pair of short pulses every 2 x freq us
 // this assume that one low FET is conducting (s/b B)
-void fetBeep(uint16_t freq, uint16_t duration) {
-    uint16_t prevReloadVal;
-    int i;
+static void fetBeepRun(int unused) {
+    static uint16_t i;
 
-    fetSetStep(0);
+    TIMER_TASK_BEGIN(&fetBeepTask);
 
-    prevReloadVal = runIWDGInit(999);
+    while (fetBeepTail != fetBeepHead) {
+	if (fetBeepQueue[fetBeepTail].freq == 0) {
+	    TIMER_TASK_DELAY(&fetBeepTask, fetBeepQueue[fetBeepTail].duration * 1000);
+	}
+	else {
+	    // the motor has the bridge, drop the tune before touching the step
+	    if (state > ESC_STATE_STOPPED) {
+		fetBeepTail = fetBeepHead;
+		break;
+	    }
 
-    __asm volatile ("cpsid i");
+	    fetSetStep(0);
+	    fetBeeping = 1;
 
-    for (i = 0; i < duration; i++) {
-	// reload the hardware watchdog
-	runFeedIWDG();
+	    for (i = 0; i < fetBeepQueue[fetBeepTail].duration; i++) {
+		// motor wants the bridge
+		if (state > ESC_STATE_STOPPED)
+		    break;
 
-	FET_A_H_ON;
-	timerDelay(8);
-	FET_A_H_OFF;
+		FET_A_H_ON;
+		timerDelay(8);
+		FET_A_H_OFF;
 
-	timerDelay(freq);
+		TIMER_TASK_DELAY(&fetBeepTask, fetBeepQueue[fetBeepTail].freq);
 
-	// reload the hardware watchdog
-	runFeedIWDG();
+		if (state > ESC_STATE_STOPPED)
+		    break;
 
-	FET_C_L_ON;
-	timerDelay(8);
-	FET_C_H_OFF;
+		FET_C_L_ON;
+		timerDelay(8);
+		FET_C_H_OFF;
 
-	timerDelay(freq);
+		TIMER_TASK_DELAY(&fetBeepTask, fetBeepQueue[fetBeepTail].freq);
+	    }
+
+	    fetBeeping = 0;
+
+	    // drop the rest of the tune
+	    if (state > ESC_STATE_STOPPED)
+		fetBeepTail = fetBeepHead;
+	}
+
+	if (fetBeepTail != fetBeepHead)
+	    fetBeepTail = (fetBeepTail + 1) % FET_BEEP_QUEUE;
     }
 
-    __asm volatile ("cpsie i");
+    TIMER_TASK_END(&fetBeepTask);
 
-    runIWDGInit(prevReloadVal);
+    // no alarm for the next pulse, give up on the tune so a later fetBeep() starts afresh
+    fetBeeping = 0;
+    fetBeepTail = fetBeepHead;
+}
+
+// queue a note, freq == 0 is a rest of duration ms
+void fetBeep(uint16_t freq, uint16_t duration) {
+    uint8_t head;
+
+    __asm volatile ("cpsid i");
+
+    head = (fetBeepHead + 1) % FET_BEEP_QUEUE;
+
+    if (head != fetBeepTail) {
+	fetBeepQueue[fetBeepHead].freq = freq;
+	fetBeepQueue[fetBeepHead].duration = duration;
+	fetBeepHead = head;
+
+	if (!timerTaskBusy(&fetBeepTask))
+	    timerTaskStart(&fetBeepTask, fetBeepRun, 0);
+    }
+
+    __asm volatile ("cpsie i");
 }
 
 void fetSetBraking(int8_t value) {
@@ -351,20 +472,16 @@ void fetSetBraking(int8_t value) {
     }
 }
 
-void _fetSetDutyCycle(int32_t dutyCycle) {
+// hiDuty & loDuty in whole timer ticks
+static inline void _fetLoadDutyCycle(int32_t hiDuty, int32_t loDuty) {
     register int32_t tmp;
 
-    tmp = dutyCycle;
-
-    if (state == ESC_STATE_DISARMED)
-	tmp = 0;
-
-    FET_H_TIMER->FET_A_H_CHANNEL = tmp;
-    FET_H_TIMER->FET_B_H_CHANNEL = tmp;
-    FET_H_TIMER->FET_C_H_CHANNEL = tmp;
+    FET_H_TIMER->FET_A_H_CHANNEL = hiDuty;
+    FET_H_TIMER->FET_B_H_CHANNEL = hiDuty;
+    FET_H_TIMER->FET_C_H_CHANNEL = hiDuty;
 
     if (fetBrakingEnabled) {
-	tmp = dutyCycle + fetPeriod / 8;
+	tmp = loDuty + fetPeriod / 8;
 
 	if (tmp < 0)
 	    tmp = 0;
@@ -377,25 +494,107 @@ void _fetSetDutyCycle(int32_t dutyCycle) {
     }
 }
 
-void fetSetDutyCycle(int32_t requestedDutyCycle) {
-    if (requestedDutyCycle > fetPeriod)
-	requestedDutyCycle = fetPeriod;
-    else if (requestedDutyCycle < 0)
-	requestedDutyCycle = 0;
+// dutyCycle is a fraction of FET_DUTY_PERIOD.  Whole tick values are
+// loaded directly, anything else (or a pending switching frequency
+// change) is left to the update ISR.
+void _fetSetDutyCycle(int32_t dutyCycle) {
+    register int32_t tmp;
 
-    fetDutyCycle = requestedDutyCycle;
+    tmp = dutyCycle;
+
+    if (state == ESC_STATE_DISARMED)
+	tmp = 0;
+
+    fetDitherDuty = tmp;
+
+    tmp = (tmp * fetPeriod)>>(FET_DUTY_BITS - FET_DUTY_FRAC_BITS);
+
+    if ((tmp & FET_DUTY_FRAC_MASK) || fetNextPeriod) {
+	*FET_DITHER_BITBAND = 1;
+    }
+    else {
+	*FET_DITHER_BITBAND = 0;
+	_fetLoadDutyCycle(tmp>>FET_DUTY_FRAC_BITS, (dutyCycle * fetPeriod)>>FET_DUTY_BITS);
+    }
 }
 
-static inline int8_t fetGetNextStep(int8_t step) {
-    int8_t nextStep;
+// Runs on every PWM update event (twice per period, center aligned.)
+//
+// A scheduled switching period is written to both (preloaded) ARRs
+// here, right after an update, so both timers pick it up together
+// with the rescaled duty at the next one.  Too close to a counter
+// turn around it waits for the next update instead.
+//
+// Duty is a first order sigma-delta: the fractional residue of each
+// half period is carried into the next, so the average duty keeps the
+// full resolution of fetDitherDuty regardless of switching frequency.
+void FET_DITHER_ISR(void) {
+    register int32_t duty;
+    register int32_t cnt;
+
+    FET_H_TIMER->SR = (uint16_t)~TIM_IT_Update;
+
+    if (fetNextPeriod) {
+	cnt = FET_MASTER_TIMER->CNT;
+
+	if (cnt > FET_SWITCH_GUARD && cnt < fetPeriod - FET_SWITCH_GUARD) {
+	    FET_MASTER_TIMER->ARR = fetNextPeriod - 1;
+	    FET_H_TIMER->ARR = fetNextPeriod - 1;
+	    fetPeriod = fetNextPeriod;
+	    fetNextPeriod = 0;
+	}
+    }
+
+    fetDitherAccum = (fetDitherAccum & FET_DUTY_FRAC_MASK) + ((fetDitherDuty * fetPeriod)>>(FET_DUTY_BITS - FET_DUTY_FRAC_BITS));
+    duty = fetDitherAccum>>FET_DUTY_FRAC_BITS;
+
+    _fetLoadDutyCycle(duty, duty);
+}
+
+// Switching frequency follows the operating point: SWITCH_FREQ at
+// light load for low current ripple, falling linearly to
+// SWITCH_FREQ_MIN at SWITCH_FREQ_DUTY to cut switching losses, but
+// never below FET_MIN_PWM_PER_STEP PWM periods per commutation.
+void fetScheduleSwitchFreq(float rpm, int32_t dutyCycle) {
+    float freq;
+    int32_t period;
+    int32_t diff;
+
+    // disabled
+    if (fetMinPeriod >= fetMaxPeriod)
+	return;
+
+    freq = p[SWITCH_FREQ] - (p[SWITCH_FREQ] - p[SWITCH_FREQ_MIN]) * dutyCycle / fetSwitchDuty;
+
+    // commutations per second == rpm * poles / 2 / 60 * 6
+    if (freq < rpm * p[MOTOR_POLES] * (0.05f * FET_MIN_PWM_PER_STEP / 1000.0f))
+	freq = rpm * p[MOTOR_POLES] * (0.05f * FET_MIN_PWM_PER_STEP / 1000.0f);
+
+    if (freq <= 0.0f)
+	period = fetMaxPeriod;
+    else
+	period = FET_AHB_FREQ / (freq * 1000.0f * 2.0f);
+
+    if (period > fetMaxPeriod)
+	period = fetMaxPeriod;
+    else if (period < fetMinPeriod)
+	period = fetMinPeriod;
 
-    nextStep = step + fetStepDir;
-    if (nextStep > 6)
-	nextStep = 1;
-    else if (nextStep < 1)
-	nextStep = 6;
+    diff = period - fetPeriod;
+    if (diff < 0)
+	diff = -diff;
 
-    return nextStep;
+    if (diff > fetPeriod / FET_SWITCH_HYSTERESIS)
+	fetNextPeriod = period;
+}
+
+void fetSetDutyCycle(int32_t requestedDutyCycle) {
+    if (requestedDutyCycle > FET_DUTY_PERIOD)
+	requestedDutyCycle = FET_DUTY_PERIOD;
+    else if (requestedDutyCycle < 0)
+	requestedDutyCycle = 0;
+
+    fetDutyCycle = requestedDutyCycle;
 }
 
 //
@@ -404,25 +603,34 @@ static inline int8_t fetGetNextStep(int8_t step) {
 // control of the output pin by the PWM timer.  When disabled, the
 // GPIO output state is imposed on the pin (FET off.)
 //
+// All GPIOB enables go out in a single CRL write and all GPIOB
+// low side states in a single BSRR write, both taken from a table
+// precomputed for each step and braking state.
+//
 void fetSetStep(int n) {
+    register fetStepPattern_t *s = &fetStepTable[fetBrakingEnabled && fetBraking][n];
+#ifdef ESC_DEBUG
+    register uint32_t cycles = FET_CYCLE_COUNTER;
+#endif
+
     __asm volatile ("cpsid i");
     fetCommutationMicros = timerGetMicros();
-    __asm volatile ("cpsie i");
 
-    fetNextStep = fetGetNextStep(n);
+    // set high side (and low side braking)
+    FET_CRL_PORT->CRL = (FET_CRL_PORT->CRL & ~FET_CRL_MASK) | s->crl;
+    *CH_BITBAND = s->ch;
+    *AL_BITBAND = s->al;
 
-    // set high side
-    *AH_BITBAND = AH[n];
-    *BH_BITBAND = BH[n];
-    *CH_BITBAND = CH[n];
+    // set low side
+    FET_B_L_PORT->BSRR = s->portB;
+    FET_A_L_PORT->BSRR = s->portA;
+    __asm volatile ("cpsie i");
 
-    if (fetBrakingEnabled)
-	fetSetBraking(fetBraking);
+#ifdef ESC_DEBUG
+    fetStepCycles = FET_CYCLE_COUNTER - cycles;
+#endif
 
-    // set low side
-    FET_A_L_PORT->BSRR = AL[n];
-    FET_B_L_PORT->BSRR = BL[n];
-    FET_C_L_PORT->BSRR = CL[n];
+    fetNextStep = fetNextStepTable[fetStepDir > 0][n];
 }
 
 void fetSetBaseTime(int32_t period) {
@@ -451,8 +659,10 @@ void fetInit(void) {
     NVIC_InitTypeDef NVIC_InitStructure;
 
     fetSetConstants();
+    fetCreateStepTables();
+    fetCreateSine();
 
-    fetDutyCycle = fetPeriod;
+    fetDutyCycle = FET_DUTY_PERIOD;
     fetStep = 0;
 
     // setup low side gates
@@ -505,7 +715,7 @@ void fetInit(void) {
     TIM_OCStructInit(&TIM_OCInitStructure);
     TIM_OCInitStructure.TIM_OCMode = TIM_OCMode_PWM1;
     TIM_OCInitStructure.TIM_OutputState = TIM_OutputState_Enable;
-    TIM_OCInitStructure.TIM_Pulse = fetDutyCycle;
+    TIM_OCInitStructure.TIM_Pulse = fetPeriod;
     TIM_OCInitStructure.TIM_OCPolarity = TIM_OCPolarity_Low;
 
     // Phase A
@@ -528,7 +738,7 @@ void fetInit(void) {
     TIM_OCStructInit(&TIM_OCInitStructure);
     TIM_OCInitStructure.TIM_OCMode = TIM_OCMode_PWM1;
     TIM_OCInitStructure.TIM_OutputState = TIM_OutputState_Enable;
-    TIM_OCInitStructure.TIM_Pulse = fetDutyCycle;
+    TIM_OCInitStructure.TIM_Pulse = fetPeriod;
     TIM_OCInitStructure.TIM_OCPolarity = TIM_OCPolarity_High;
 
     // Phase A
@@ -551,6 +761,13 @@ void fetInit(void) {
     FET_H_TIMER->CNT = 0;
     FET_MASTER_TIMER->CNT = 0;
 
+    // duty cycle dither, update interrupt is enabled on demand
+    NVIC_InitStructure.NVIC_IRQChannel = FET_DITHER_IRQ_CH;
+    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = FET_DITHER_IRQ_PRIORITY;
+    NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+    NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+    NVIC_Init(&NVIC_InitStructure);
+
     // now set AF mode for the high side gates
     GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
 
@@ -588,7 +805,96 @@ void fetMissedCommutate(int period) {
     timerSetAlarm2(newPeriod, fetMissedCommutate, period);
 }
 
+// first in order detection since runStart()
+static inline void fetRecordFirstDetect(void) {
+    if (!runFirstDetectTime)
+	runFirstDetectTime = ((timerMicros >= runStartMicros) ? (timerMicros - runStartMicros) : (TIMER_MASK - runStartMicros + timerMicros)) / TIMER_MULT;
+}
+
+// open loop start: hand over to commutation early once the
+// rotor is seen following the rotating field
+static void fetStartSeqDetect(void) {
+    uint16_t exitDetects = fetStartProfile[fetStartSeg].exitDetects;
+
+    if (!exitDetects || !fetStartProfile[fetStartSeg].ms)
+	return;
+
+    if (fetStep == fetNextStep) {
+	if (++fetStartSeqDetects >= exitDetects) {
+	    timerCancelAlarm2();
+
+	    adcMaxAmps = 0;
+	    fetGoodDetects = 0;
+	    fetBadDetects = 0;
+	    fetTotalBadDetects = 0;
+
+	    state = ESC_STATE_STARTING;
+	}
+    }
+    else {
+	fetStartSeqDetects = 0;
+    }
+}
+
+// matched duty cycle for the measured BEMF, assumes the phase
+// sense dividers match SENSE_VIN
+static int32_t fetCatchDuty(void) {
+    int32_t vin = adcAvgVolts>>ADC_VOLTS_PRECISION;
+    int32_t duty;
+
+    if (vin <= 0)
+	return 0;
+
+    duty = (int64_t)adcBemfSpread * FET_DUTY_PERIOD / (vin * ADC_HIST_SAMPLES);
+
+    if (duty > FET_DUTY_PERIOD)
+	duty = FET_DUTY_PERIOD;
+
+    return duty;
+}
+
+// called at each would-be commutation while listening to a spinning rotor
+static void fetCatchCommutate(int period) {
+    if (fetStep == fetNextStepTable[fetStepDir > 0][fetCatchStep]) {
+	fetCatchDetects++;
+	fetRecordFirstDetect();
+    }
+    else {
+	// stopped, reversed or noise
+	fetCatchDetects = 0;
+    }
+    fetCatchStep = fetStep;
+
+    if (fetCatchDetects >= FET_CATCH_DETECTS) {
+	fetCatching = 0;
+
+	fetDutyCycle = fetCatchDuty();
+	_fetSetDutyCycle(fetDutyCycle);
+
+	// already in sync, the next watchdog pass promotes to RUNNING
+	fetGoodDetects = fetStartDetects + 1;
+	fetBadDetects = 0;
+	fetTotalBadDetects = 0;
+	adcMaxAmps = 0;
+	state = ESC_STATE_STARTING;
+
+	fetSetStep(fetStep);
+	timerSetAlarm2(period + period/2, fetMissedCommutate, period);
+    }
+}
+
 void fetCommutate(int period) {
+    if (state == ESC_STATE_NOCOMM && fetCatching) {
+	fetCatchCommutate(period);
+	return;
+    }
+
+    if (fetStep == fetNextStep)
+	fetRecordFirstDetect();
+
+    if (state == ESC_STATE_NOCOMM)
+	fetStartSeqDetect();
+
     if (state != ESC_STATE_NOCOMM) {
 	// keep count of in order ZC detections
 	if (fetStep == fetNextStep) {
@@ -616,10 +922,35 @@ void fetCommutate(int period) {
     }
 }
 
+//
+// Listen for a windmilling rotor with all FETs off.  The ADC crossing
+// detection runs as usual but commutations are not applied until
+// FET_CATCH_DETECTS crossings arrive in order for the run direction.
+// The run watchdog falls back to a normal start on timeout.
+//
+void fetCatchInit(void) {
+    fetSetBraking(0);
+    fetSetDutyCycle(0);
+    _fetSetDutyCycle(0);
+    fetSetStep(0);
+    FET_B_L_OFF;	// step 0 leaves B low on
+
+    fetCatchStep = 0;
+    fetCatchDetects = 0;
+    adcBemfSpread = 0;
+    adcSetCrossingPeriod(adcMaxPeriod/2);
+    detectedCrossing = timerMicros;
+
+    state = ESC_STATE_NOCOMM;
+    fetCatching = 1;
+}
+
 // initiates motor start sequence
 void motorStartSeqInit(void) {
     // set globals to start position
-    startSeqCnt = 0;
+    fetStartSeg = 0;
+    fetStartSegTicks = 0;
+    fetStartSeqDetects = 0;
 
     // set first step
     fetSetBraking(0);
@@ -634,7 +965,7 @@ void motorStartSeqInit(void) {
 
 void fetStartCommutation(uint8_t startStep) {
     fetSetBraking(0);
-    fetStartDuty = p[START_VOLTAGE] / avgVolts * fetPeriod;
+    fetStartDuty = p[START_VOLTAGE] / avgVolts * FET_DUTY_PERIOD;
     adcSetCrossingPeriod(adcMaxPeriod/2);
     detectedCrossing = timerMicros;
     fetDutyCycle = fetStartDuty;
@@ -649,72 +980,201 @@ void fetStartCommutation(uint8_t startStep) {
     timerSetAlarm2(0, fetMissedCommutate, crossingPeriod);
 }
 
-// generates motor start sequence
-void motorStartSeq(int period) {
-    int nextPeriod;
-
-    // Static field to align rotor. Without commutation.
-    if (startSeqCnt < p[START_ALIGN_TIME]) {
-	// PWM ramp up
-	fetStartDuty = p[START_ALIGN_VOLTAGE] * ((float)startSeqCnt / p[START_ALIGN_TIME]) / avgVolts * fetPeriod;
-	fetDutyCycle = fetStartDuty;
-	_fetSetDutyCycle(fetDutyCycle);
+// default start profile from the START_* parameters
+void fetCreateStartProfile(void) {
+    fetStartSegment_t *s = fetStartProfile;
+    float p0, p1;
+
+    // static field to align rotor
+    if (p[START_ALIGN_TIME] > 0) {
+	s->ms = p[START_ALIGN_TIME];
+	s->volts[0] = 0.0f;
+	s->volts[1] = p[START_ALIGN_VOLTAGE];
+	s->period[0] = 0;
+	s->period[1] = 0;
+	s->exitDetects = 0;
+	s++;
+    }
 
-	// Prepare next function call
-	period     = 1000 * TIMER_MULT; // 1 ms
-	nextPeriod = 1000 * TIMER_MULT;
-	timerSetAlarm2(period, motorStartSeq, nextPeriod);
+    // rotating field with optional acceleration
+    if (p[START_STEPS_NUM] > 0) {
+	p0 = p[MAX_PERIOD];
+	p1 = p0 - p[START_STEPS_ACCEL] * (p[START_STEPS_NUM] - 1);
+	if (p1 < p[START_STEPS_PERIOD])
+	    p1 = p[START_STEPS_PERIOD];
+	if (p1 > p0)
+	    p1 = p0;
+
+	s->ms = p[START_STEPS_NUM] * (p0 + p1) * 0.5f / 1000.0f + 1;
+	s->volts[0] = p[START_VOLTAGE];
+	s->volts[1] = p[START_VOLTAGE];
+	s->period[0] = p0;
+	s->period[1] = p1;
+	s->exitDetects = 0;
+	s++;
     }
-    // Rotating field with optional acceleration but without commutation.
-    else if (startSeqCnt < (p[START_ALIGN_TIME] + p[START_STEPS_NUM])) {
-	// One time if entering "Rotating field"
-	if (startSeqCnt == p[START_ALIGN_TIME]) {
-	    period = p[MAX_PERIOD] * TIMER_MULT;
-	    detectedCrossing = timerMicros;
-	}
 
+    // terminate
+    s->ms = 0;
+}
+
+static void fetStartHandover(void) {
+    adcMaxAmps = 0;
+    fetGoodDetects = 0;
+    fetBadDetects = 0;
+    fetTotalBadDetects = 0;
+
+    // coming from a rotating field
+    if (fetStartSeg > 0 && fetStartProfile[fetStartSeg-1].period[0]) {
+	// last one
 	fetSetStep(fetNextStep);
 
-	// Set PWM
-	fetStartDuty = p[START_VOLTAGE] / avgVolts * fetPeriod;
-	fetDutyCycle = fetStartDuty;
-	_fetSetDutyCycle(fetDutyCycle);
+	// cancel any existing ZC detection
+	timerCancelAlarm1();
+
+	// allow normal commutation
+	state = ESC_STATE_STARTING;
+    }
+    // Continue normal startup with commutation
+    else {
+	// allow normal commutation
+	state = ESC_STATE_STARTING;
+
+	fetStartCommutation(fetNextStep);
+    }
+}
+
+//
+// Generates the motor start sequence from fetStartProfile.  Each
+// segment ramps motor voltage and forced step period linearly over
+// its length; a zero period holds the current step (align.)
+//
+void motorStartSeq(int unused) {
+    fetStartSegment_t *s = &fetStartProfile[fetStartSeg];
+    int32_t segTicks;
+    int32_t next;
+    float f;
+
+    segTicks = s->ms * 1000 * TIMER_MULT;
+
+    // next segment
+    if (s->ms && fetStartSegTicks >= segTicks) {
+	fetStartSeg++;
+	fetStartSegTicks = 0;
+	fetStartSeqDetects = 0;
+	detectedCrossing = timerMicros;
+
+	s++;
+	segTicks = s->ms * 1000 * TIMER_MULT;
+    }
+
+    // end of profile, let motor run
+    if (!s->ms) {
+	fetStartHandover();
+	return;
+    }
+
+    f = (float)fetStartSegTicks / segTicks;
 
-	// Prepare next function call
-	nextPeriod = period - (p[START_STEPS_ACCEL] * TIMER_MULT);
-	if (nextPeriod < p[START_STEPS_PERIOD] * TIMER_MULT)
-	    nextPeriod = crossingPeriod;
+    // PWM ramp
+    fetStartDuty = (s->volts[0] + (s->volts[1] - s->volts[0]) * f) / avgVolts * FET_DUTY_PERIOD;
+    fetDutyCycle = fetStartDuty;
+    _fetSetDutyCycle(fetDutyCycle);
 
-	timerSetAlarm2(period, motorStartSeq, nextPeriod);
+    if (s->period[0]) {
+	fetSetStep(fetNextStep);
+	next = (s->period[0] + (s->period[1] - s->period[0]) * f) * TIMER_MULT;
     }
     else {
-	// let motor run
-	if (p[START_STEPS_NUM]) {
-	    adcMaxAmps = 0;
-	    fetGoodDetects = 0;
-	    fetBadDetects = 0;
-	    fetTotalBadDetects = 0;
+	next = 1000 * TIMER_MULT;   // 1 ms
+    }
 
-	    // last one
-	    fetSetStep(fetNextStep);
+    fetStartSegTicks += next;
+    timerSetAlarm2(next, motorStartSeq, 0);
+}
 
-	    // cancel any existing ZC detection
-	    timerCancelAlarm1();
+// vector order, opposite vectors back to back so any
+// rotor nudge from one pulse is undone by the next
+const uint8_t fetSenseOrder[6] = {1, 4, 2, 5, 3, 6};
 
-	    // allow normal commutation
-	    state = ESC_STATE_STARTING;
-	}
-	// Continue normal startup with commutation
-	else {
-	    // allow normal commutation
-	    state = ESC_STATE_STARTING;
+//
+// Inductive sensing of the rotor position at standstill.
+//
+// Each of the six step vectors gets short full voltage pulses through
+// direct GPIO control.  The stator iron saturates further where the
+// pulse flux adds to the magnet's, so the vector with the fastest
+// current rise points at the rotor's north pole.  The larger of its
+// two neighbours splits that 60 degree sector in half, and the start
+// step is the one leading the rotor by closest to 90 degrees in the
+// run direction.
+//
+// Returns the step to start commutating from, or 0 if there was no
+// clear maximum (fall back to the align sequence.)
+//
+uint8_t fetSenseRotor(void) {
+    int32_t amps[7];
+    int32_t base;
+    uint32_t hi;
+    int i, j, n;
+    int max, opp, fwd, bwd;
+
+    if (state != ESC_STATE_STOPPED)
+	return 0;
+
+    fetSetStep(0);
+
+    // everything off, high side is under GPIO control in step 0
+    FET_B_L_PORT->BSRR = AH_OFF | BH_OFF | CH_OFF | BL_OFF | CL_OFF;
+    FET_A_L_PORT->BSRR = AL_OFF;
+
+    for (i = 0; i < 7; i++)
+	amps[i] = 0;
+
+    timerDelay(fetSenseMicros*FET_SENSE_DECAY);
+    base = adcGetInstantCurrent();
 
-	    fetStartCommutation(fetNextStep);
+    for (j = 0; j < FET_SENSE_REPEAT; j++) {
+	for (i = 0; i < 6; i++) {
+	    n = fetSenseOrder[i];
+	    hi = (AH[n] ? AH_ON : 0) | (BH[n] ? BH_ON : 0) | (CH[n] ? CH_ON : 0);
+
+	    __asm volatile ("cpsid i");
+	    FET_A_L_PORT->BSRR = AL[n];
+	    FET_B_L_PORT->BSRR = BL[n] | CL[n];
+	    FET_A_H_PORT->BSRR = hi;
+
+	    timerDelay(fetSenseMicros);
+	    amps[n] += adcGetInstantCurrent() - base;
+
+	    FET_A_H_PORT->BSRR = AH_OFF | BH_OFF | CH_OFF;
+	    FET_B_L_PORT->BSRR = BL_OFF | CL_OFF;
+	    FET_A_L_PORT->BSRR = AL_OFF;
+	    __asm volatile ("cpsie i");
+
+	    timerDelay(fetSenseMicros*FET_SENSE_DECAY);
 	}
     }
 
-    // count up step of startup sequence
-    startSeqCnt++;
+    fetSetStep(0);
+
+    max = 1;
+    for (i = 2; i <= 6; i++)
+	if (amps[i] > amps[max])
+	    max = i;
+
+    opp = (max + 2) % 6 + 1;
+
+    if (amps[max] <= 0 || (amps[max] - amps[opp]) < amps[max] / FET_SENSE_MIN_DIFF)
+	return 0;
+
+    fwd = fetNextStepTable[fetStepDir > 0][max];
+    bwd = fetNextStepTable[fetStepDir <= 0][max];
+
+    // rotor sits on the forward side of the vector
+    if (amps[fwd] > amps[bwd])
+	return fetNextStepTable[fetStepDir > 0][fwd];
+    else
+	return fwd;
 }
 
 void fetTest(void) {
@@ -762,11 +1222,16 @@ void fetTest(void) {
 
 void fetSetConstants(void) {
     float switchFreq = p[SWITCH_FREQ];
+    float switchFreqMin = p[SWITCH_FREQ_MIN];
+    float switchDuty = p[SWITCH_FREQ_DUTY];
     float startVoltage = p[START_VOLTAGE];
     float startDetects = p[GOOD_DETECTS_START];
     float disarmDetects = p[BAD_DETECTS_DISARM];
     float fetBraking = p[FET_BRAKING];
     float servoMaxRate = p[SERVO_MAX_RATE];
+    float startSense = p[START_SENSE];
+    float senseMicros = p[START_SENSE_MICROS];
+    float startCatch = p[START_CATCH];
 
     // bounds checking
     if (switchFreq > FET_MAX_SWITCH_FREQ)
@@ -774,6 +1239,19 @@ void fetSetConstants(void) {
     else if (switchFreq < FET_MIN_SWITCH_FREQ)
 	switchFreq = FET_MIN_SWITCH_FREQ;
 
+    // 0 disables scheduling
+    if (switchFreqMin > switchFreq)
+	switchFreqMin = switchFreq;
+    else if (switchFreqMin > 0.0f && switchFreqMin < FET_MIN_SWITCH_FREQ)
+	switchFreqMin = FET_MIN_SWITCH_FREQ;
+    else if (switchFreqMin < 0.0f)
+	switchFreqMin = 0.0f;
+
+    if (switchDuty > FET_MAX_SWITCH_DUTY)
+	switchDuty = FET_MAX_SWITCH_DUTY;
+    else if (switchDuty < FET_MIN_SWITCH_DUTY)
+	switchDuty = FET_MIN_SWITCH_DUTY;
+
     if (startVoltage > FET_MAX_START_VOLTAGE)
 	startVoltage = FET_MAX_START_VOLTAGE;
     else if (startVoltage < FET_MIN_START_VOLTAGE)
@@ -797,27 +1275,54 @@ void fetSetConstants(void) {
     if (servoMaxRate <= 0.0f)
 	servoMaxRate = 360.0f;
 
+    if (startSense > 0.0f)
+	startSense = 1.0f;
+    else
+	startSense = 0.0f;
+
+    if (startCatch > 0.0f)
+	startCatch = 1.0f;
+    else
+	startCatch = 0.0f;
+
+    if (senseMicros > FET_MAX_SENSE_MICROS)
+	senseMicros = FET_MAX_SENSE_MICROS;
+    else if (senseMicros < FET_MIN_SENSE_MICROS)
+	senseMicros = FET_MIN_SENSE_MICROS;
+
     fetSwitchFreq = switchFreq * 1000 * 2;
     fetPeriod = FET_AHB_FREQ/fetSwitchFreq;     // bus speed / switching frequency - depends on fetSwitchFreq
+    fetNextPeriod = 0;
     fetSetBaseTime(fetPeriod);
 
+    // switching frequency scheduling range (fetMinPeriod >= fetMaxPeriod disables)
+    fetMinPeriod = fetPeriod;
+    fetMaxPeriod = (switchFreqMin > 0.0f) ? FET_AHB_FREQ/(int32_t)(switchFreqMin * 1000 * 2) : fetPeriod;
+    fetSwitchDuty = switchDuty * 0.01f * FET_DUTY_PERIOD;
+
     fetStartDetects = startDetects;
     fetDisarmDetects = disarmDetects;
+    fetSenseMicros = senseMicros;
     fetBrakingEnabled = (int8_t)fetBraking;
     fetServoMaxRate = servoMaxRate / RUN_FREQ * p[MOTOR_POLES] * 0.5f;
 
+    fetCreateStartProfile();
+
     if (p[DIRECTION] >= 0)
 	fetStepDir = 1;
     else
 	fetStepDir = -1;
 
     p[SWITCH_FREQ] = switchFreq;
+    p[SWITCH_FREQ_MIN] = switchFreqMin;
+    p[SWITCH_FREQ_DUTY] = switchDuty;
     p[START_VOLTAGE] = startVoltage;
     p[GOOD_DETECTS_START] = startDetects;
     p[BAD_DETECTS_DISARM] = disarmDetects;
     p[FET_BRAKING] = fetBraking;
     p[SERVO_MAX_RATE] = servoMaxRate;
+    p[START_SENSE] = startSense;
+    p[START_SENSE_MICROS] = senseMicros;
+    p[START_CATCH] = startCatch;
     p[DIRECTION] = fetStepDir;
-
-    fetCreateSine();
 }
\ No newline at end of file
@@ -76,6 +76,17 @@
 #define BL_BITBAND		((uint32_t *)(0x42000000 + (0x10C00*32) + (3*4)))
 #define CL_BITBAND		((uint32_t *)(0x42000000 + (0x10C00*32) + (7*4)))
 
+// the same switches as port configuration (CNF1) bits, used to
+// merge all GPIOB changes of a commutation step into one CRL write
+#define AH_CRL_EN		((uint32_t)1<<27)		    // GPIOB->CRL
+#define BH_CRL_EN		((uint32_t)1<<31)		    // GPIOB->CRL
+#define BL_CRL_EN		((uint32_t)1<<3)		    // GPIOB->CRL
+#define CL_CRL_EN		((uint32_t)1<<7)		    // GPIOB->CRL
+#define FET_CRL_MASK		(AH_CRL_EN | BH_CRL_EN | BL_CRL_EN | CL_CRL_EN)
+#define FET_CRL_PORT		GPIOB
+
+#define FET_CYCLE_COUNTER	(*(volatile uint32_t *)0xE0001004) // DWT_CYCCNT
+
 #define FET_MASTER_TIMER        TIM3
 #define FET_MASTER_DBGMCU_STOP  DBGMCU_TIM3_STOP
 
@@ -85,6 +96,19 @@
 #define FET_DBGMCU_STOP		DBGMCU_TIM4_STOP
 #define FET_AHB_FREQ		(SystemCoreClock/2)		    // 36Mhz
 
+// duty cycles are a fraction of FET_DUTY_PERIOD, independent of the
+// switching frequency.  Converted to timer ticks they keep
+// FET_DUTY_FRAC_BITS below one tick, which the update ISR dithers
+// across PWM half periods.
+#define FET_DUTY_BITS		16
+#define FET_DUTY_PERIOD		(1<<FET_DUTY_BITS)
+#define FET_DUTY_FRAC_BITS	8
+#define FET_DUTY_FRAC_MASK	((1<<FET_DUTY_FRAC_BITS)-1)
+#define FET_DITHER_IRQ_CH	TIM4_IRQn
+#define FET_DITHER_ISR		TIM4_IRQHandler
+#define FET_DITHER_IRQ_PRIORITY	(TIMER_IRQ_PRIORITY+1)		    // must not miss an update
+#define FET_DITHER_BITBAND	((uint32_t *)(0x42000000 + (0x0080C*32) + (0*4)))   // TIM4->DIER UIE
+
 // HI side timer channels
 #define FET_A_H_CHANNEL		CCR1
 #define FET_B_H_CHANNEL		CCR2
@@ -104,6 +128,11 @@
 
 #define FET_MIN_SWITCH_FREQ	4				    // KHz
 #define FET_MAX_SWITCH_FREQ	64				    // KHz
+#define FET_MIN_SWITCH_DUTY	5.0				    // %
+#define FET_MAX_SWITCH_DUTY	100.0				    // %
+#define FET_MIN_PWM_PER_STEP	6				    // PWM periods per commutation
+#define FET_SWITCH_HYSTERESIS	32				    // period must move by 1/32 to reschedule
+#define FET_SWITCH_GUARD	16				    // ticks from a counter turn around
 #define FET_MIN_START_VOLTAGE	0.1				    // %
 #define FET_MAX_START_VOLTAGE	3.0				    // %
 #define FET_MIN_START_DETECTS	1
@@ -111,6 +140,14 @@
 #define FET_MIN_DISARM_DETECTS	1
 #define FET_MAX_DISARM_DETECTS	512
 #define FET_MIN_LIMIT_STEP	0.1				    // %
+#define FET_MIN_SENSE_MICROS	5				    // us
+#define FET_MAX_SENSE_MICROS	200				    // us
+#define FET_SENSE_REPEAT	4				    // pulses per vector
+#define FET_SENSE_DECAY		8				    // current decay wait, in pulse widths
+#define FET_SENSE_MIN_DIFF	64				    // opposite vectors must differ by 1/64 of the current rise
+#define FET_START_SEGMENTS	4
+#define FET_CATCH_DETECTS	12				    // in order crossings (2 electrical revs) to sync to a spinning rotor
+#define FET_CATCH_TIMEOUT	(100000*TIMER_MULT)		    // give up listening after 100ms
 #define FET_MAX_LIMIT_STEP	100.0				    // %
 
 #define FET_PANIC { \
@@ -122,6 +159,24 @@
     FET_C_L_PORT->BSRR = CL_OFF; \
 }
 
+// precomputed port writes for one commutation step
+typedef struct {
+    uint32_t crl;		// FET_CRL_PORT->CRL enable bits
+    uint32_t portB;		// GPIOB BSRR (B & C low side)
+    uint32_t portA;		// GPIOA BSRR (A low side)
+    uint32_t ch;		// C high side enable (*CH_BITBAND)
+    uint32_t al;		// A low side braking enable (*AL_BITBAND)
+} fetStepPattern_t;
+
+// one segment of the start profile, motor voltage and forced
+// step period ramp linearly over the segment's length
+typedef struct {
+    uint16_t ms;		// length, 0 terminates the profile
+    float volts[2];		// motor voltage at begin / end
+    uint16_t period[2];		// us between forced steps at begin / end, 0 == hold step (align)
+    uint16_t exitDetects;	// hand over to commutation after this many in order detections, 0 == never
+} fetStartSegment_t;
+
 enum fetSelfTestResults {
     FET_TEST_NOT_RUN = 0,
     FET_TEST_PASSED,
@@ -130,9 +185,17 @@ enum fetSelfTestResults {
     FET_TEST_C_LO_FAIL,
     FET_TEST_A_HI_FAIL,
     FET_TEST_B_HI_FAIL,
-    FET_TEST_C_HI_FAIL
+    FET_TEST_C_HI_FAIL,
+    FET_TEST_RUNNING
 };
 
+#define FET_BEEP_QUEUE		16				    // notes
+
+typedef struct {
+    uint16_t freq;		// us between pulses, 0 == rest
+    uint16_t duration;		// pulse pairs, ms when resting
+} fetBeepNote_t;
+
 extern int32_t fetSwitchFreq;
 extern int32_t fetStartDuty;
 extern int16_t fetStartDetects;
@@ -145,22 +208,31 @@ extern volatile uint32_t fetGoodDetects;
 extern volatile uint32_t fetTotalBadDetects;
 extern int32_t fetActualDutyCycle;
 extern volatile int32_t fetDutyCycle;
-extern int32_t fetPeriod;
+extern volatile int32_t fetPeriod;
 extern volatile uint32_t fetCommutationMicros;
 extern int8_t fetBrakingEnabled;
 extern int8_t fetBraking;
 extern int8_t fetStepDir;
+extern volatile int8_t fetCatching;
+extern volatile uint32_t fetStepCycles;
 extern float servoAngle;
+extern fetStartSegment_t fetStartProfile[];
 
 extern void fetInit(void);
+extern uint8_t fetSelfTestResult;
+extern volatile uint8_t fetBeeping;
 extern uint8_t fetSelfTest(void);
 extern void fetBeep(uint16_t freq, uint16_t duration);
 extern void fetCommutate(int unused);
 extern void fetSetStep(int n);
 extern void fetSetDutyCycle(int32_t dutyCycle);
+extern void fetScheduleSwitchFreq(float rpm, int32_t dutyCycle);
 extern void motorStartSeqInit (void);
 extern void motorStartSeq (int period);
+extern void fetCreateStartProfile(void);
 extern void fetStartCommutation(uint8_t startStep);
+extern uint8_t fetSenseRotor(void);
+extern void fetCatchInit(void);
 extern void fetSetConstants(void);
 extern void fetSetBraking(int8_t value);
 extern void _fetSetDutyCycle(int32_t dutyCycle);
@@ -55,6 +55,7 @@ void main(void) {
     adcInit();
     fetInit();
     serialInit();
+    serialSetRxTask(binaryRxTask);
     canInit();
     runInit();
     cliInit();
@@ -93,11 +94,13 @@ void main(void) {
         while (1) {
             idleCounter++;
 
-	    if (runCount != lastRunCount && !(runCount % (RUN_FREQ / 1000))) {
-		if (commandMode == CLI_MODE)
-		    cliCheck();
-		else
-		    binaryCheck();
+	    // binary telemetry is sampled every run loop
+	    if (runCount != lastRunCount && commandMode == BINARY_MODE) {
+		binaryCheck();
+		lastRunCount = runCount;
+	    }
+	    else if (runCount != lastRunCount && !(runCount % (RUN_FREQ / 1000))) {
+		cliCheck();
 		lastRunCount = runCount;
 	    }
 
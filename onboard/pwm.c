@@ -71,7 +71,7 @@ void pwmInit(void) {
 
     // Enable the TIM1 global Interrupt
     NVIC_InitStructure.NVIC_IRQChannel = PWM_IRQ;
-    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 2;
+    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 3;
     NVIC_InitStructure.NVIC_IRQChannelSubPriority = 1;
     NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
     NVIC_Init(&NVIC_InitStructure);
@@ -21,6 +21,7 @@
 #include "main.h"
 #include "digital.h"
 #include "stm32f10x_rcc.h"
+#include "misc.h"
 
 uint32_t rccReadBkpDr(void) {
     return *((uint16_t *)BKP_BASE + 0x04) | *((uint16_t *)BKP_BASE + 0x08)<<16;
@@ -75,6 +76,9 @@ void rccInit(void) {
     SCB->SHCSR |= (0x01<<SCB_SHCSR_BUSFAULTENA_Pos);
     SCB->SHCSR |= (0x01<<SCB_SHCSR_MEMFAULTENA_Pos);
 
+    // all 4 priority bits are preemption levels, so that commutation can preempt other ISRs
+    NVIC_PriorityGroupConfig(NVIC_PriorityGroup_4);
+
     RCC_APB2PeriphClockCmd(RCC_APB2Periph_GPIOA | RCC_APB2Periph_GPIOB | RCC_APB2Periph_GPIOC, ENABLE);
 
     RCC_APB2PeriphClockCmd(RCC_APB2Periph_TIM1, ENABLE);
@@ -46,6 +46,15 @@ float runRPMFactor;
 float runRpmLPF;
 float maxCurrentSQRT;
 uint8_t disarmReason;
+uint32_t runStartMicros;
+uint32_t runStartTime;		// us from start to running
+uint32_t runFirstDetectTime;	// us from start to first in order detection
+uint32_t runFailedStarts;
+uint32_t runReverseMicros;
+uint32_t runReverseTime;	// us from reversal request to running in the new direction
+volatile uint8_t runReversing;
+int8_t runDirection;		// requested direction in bidirectional mode
+int16_t runBidirDeadband;	// PWM us either side of center that is stop
 uint8_t commandMode;
 uint8_t runArmCount;
 volatile uint8_t runMode;
@@ -104,9 +113,14 @@ uint16_t runIWDGInit(int ms) {
 }
 
 void runDisarm(int reason) {
+    if (state == ESC_STATE_NOCOMM || state == ESC_STATE_STARTING)
+	runFailedStarts++;
+
     fetSetDutyCycle(0);
     timerCancelAlarm2();
+    runReversing = 0;
     state = ESC_STATE_DISARMED;
+    binaryCaptureTrigger(BINARY_CAPTURE_DISARM);
     pwmIsrAllOn();
     digitalHi(statusLed);   // turn off
     digitalLo(errorLed);    // turn on
@@ -121,6 +135,10 @@ void runArm(void) {
     digitalHi(errorLed);
     digitalLo(statusLed);   // turn on
 
+    // a pending reversal restarts by itself, a failed one is over
+    if (runReversing == 2)
+	runReversing = 0;
+
     if (runMode == SERVO_MODE) {
 	state = ESC_STATE_RUNNING;
     }
@@ -134,7 +152,23 @@ void runArm(void) {
     // extra beeps signifying run mode
     for (i = 0; i < runMode + 1; i++) {
 	fetBeep(150, 600);
-	timerDelay(10000);
+	fetBeep(0, 10);
+    }
+}
+
+static void runStartMotor(void) {
+    uint8_t startStep;
+
+    if (p[START_SENSE] && (startStep = fetSenseRotor())) {
+	state = ESC_STATE_STARTING;
+	fetStartCommutation(startStep);
+    }
+    else if (fetStartProfile[0].ms == 0) {
+	state = ESC_STATE_STARTING;
+	fetStartCommutation(0);
+    }
+    else {
+	motorStartSeqInit();
     }
 }
 
@@ -143,16 +177,73 @@ void runStart(void) {
        // reset integral before new motor startup
        runRpmPIDReset();
 
-	if ((p[START_ALIGN_TIME] == 0) && (p[START_STEPS_NUM] == 0)) {
-	    state = ESC_STATE_STARTING;
-	    fetStartCommutation(0);
+	runStartMicros = timerMicros;
+	runFirstDetectTime = 0;
+
+	// first try to catch a rotor that is already spinning
+	if (p[START_CATCH])
+	    fetCatchInit();
+	else
+	    runStartMotor();
+    }
+}
+
+// bidirectional mode: request a direction, reversing a spinning
+// motor by braking it down and restarting the other way around
+static void runSetDirection(int8_t dir) {
+    if (!p[BIDIRECTIONAL] || runMode == SERVO_MODE)
+	return;
+
+    if (runReversing) {
+	// changed our mind while braking
+	if (dir == fetStepDir)
+	    runReversing = 0;
+	runDirection = dir;
+    }
+    else if (dir != fetStepDir) {
+	runDirection = dir;
+
+	if (state == ESC_STATE_RUNNING) {
+	    runReverseMicros = timerMicros;
+	    runReversing = 1;
+	}
+	else if (state > ESC_STATE_STOPPED) {
+	    // still starting, just start over the other way
+	    fetSetDutyCycle(0);
+	    timerCancelAlarm2();
+	    timerCancelAlarm1();
+	    fetCatching = 0;
+	    state = ESC_STATE_STOPPED;
+	    fetStepDir = dir;
 	}
 	else {
-	    motorStartSeqInit();
+	    fetStepDir = dir;
 	}
     }
 }
 
+// called each run loop while reversing
+static inline void runReverse(void) {
+    if (state == ESC_STATE_RUNNING && rpm > RUN_REVERSE_RPM) {
+	// actively brake through zero if braking is available, coast otherwise
+	if (fetBrakingEnabled && !fetBraking)
+	    fetSetBraking(1);
+	fetSetDutyCycle(0);
+    }
+    else if (runReversing == 1) {
+	fetSetDutyCycle(0);
+	timerCancelAlarm2();
+	fetSetBraking(0);
+	runRpmPIDReset();
+
+	state = ESC_STATE_STOPPED;
+	fetStepDir = runDirection;
+	runReversing = 2;
+
+	runStart();
+    }
+}
+
 void runStop(void) {
     runMode = OPEN_LOOP;
     fetSetDutyCycle(0);
@@ -161,40 +252,68 @@ void runStop(void) {
 uint8_t runDuty(float duty) {
     uint8_t ret = 0;
 
+    if (p[BIDIRECTIONAL] && duty != 0.0f) {
+	runSetDirection(duty > 0.0f ? 1 : -1);
+	duty = fabsf(duty);
+    }
+
     if (duty >= 0.0f || duty <= 100.0f) {
 	runMode = OPEN_LOOP;
 	fetSetBraking(0);
-	fetSetDutyCycle((uint16_t)(fetPeriod*duty*0.01f));
+	fetSetDutyCycle((int32_t)(FET_DUTY_PERIOD*duty*0.01f));
 	ret = 1;
     }
 
     return ret;
 }
 
-// 0 => 2^16
-void runSetpoint(uint16_t val) {
+// duty (OPEN_LOOP) or target RPM a running motor gets for val in mode, 0 => 2^16
+float runSetpointTarget(uint8_t mode, uint16_t val) {
     float target;
 
-    if (state == ESC_STATE_RUNNING) {
-	if (runMode == OPEN_LOOP) {
-	    fetSetDutyCycle(fetPeriod * val / ((1<<16)-1));
-	}
-	else if (runMode == CLOSED_LOOP_RPM) {
-	    // target RPM
-	    target = p[PWM_RPM_SCALE] * val * (1.0f / ((1<<16)-1));
+    if (mode == OPEN_LOOP) {
+	target = FET_DUTY_PERIOD * (val * (1.0f / ((1<<16)-1)));
+    }
+    else if (mode == CLOSED_LOOP_RPM) {
+	// target RPM
+	target = p[PWM_RPM_SCALE] * val * (1.0f / ((1<<16)-1));
 
-	    // limit to configured maximum
-	    targetRpm = (target > p[PWM_RPM_SCALE]) ? p[PWM_RPM_SCALE] : target;
-	}
-	else if (runMode == CLOSED_LOOP_THRUST) {
-	    // target thrust
-	    target = maxThrust * val * (1.0f / ((1<<16)-1));
+	// limit to configured maximum
+	target = (target > p[PWM_RPM_SCALE]) ? p[PWM_RPM_SCALE] : target;
+    }
+    else {
+	// target thrust
+	target = maxThrust * val * (1.0f / ((1<<16)-1));
 
-	    // calc target RPM for requested thrust
-	    target = ((sqrtf(p[THR1TERM] * p[THR1TERM] + 4.0f * p[THR2TERM] * target) - p[THR1TERM] ) / ( 2.0f * p[THR2TERM] ));
+	// calc target RPM for requested thrust
+	target = ((sqrtf(p[THR1TERM] * p[THR1TERM] + 4.0f * p[THR2TERM] * target) - p[THR1TERM] ) / ( 2.0f * p[THR2TERM] ));
 
-	    targetRpm = (target > p[PWM_RPM_SCALE]) ? p[PWM_RPM_SCALE] : target;
+	target = (target > p[PWM_RPM_SCALE]) ? p[PWM_RPM_SCALE] : target;
+    }
+
+    return target;
+}
+
+// 0 => 2^16
+void runSetpoint(uint16_t val) {
+    // center of the range is stop, the halves run either way
+    if (p[BIDIRECTIONAL]) {
+	if (val >= 0x8000) {
+	    val = (val - 0x8000) * 2;
+	    if (val)
+		runSetDirection(1);
 	}
+	else {
+	    val = (0x8000 - val) * 2 - 1;
+	    runSetDirection(-1);
+	}
+    }
+
+    if (state == ESC_STATE_RUNNING) {
+	if (runMode == OPEN_LOOP)
+	    fetSetDutyCycle(runSetpointTarget(runMode, val));
+	else if (runMode == CLOSED_LOOP_RPM || runMode == CLOSED_LOOP_THRUST)
+	    targetRpm = runSetpointTarget(runMode, val);
     }
     else if (state == ESC_STATE_STOPPED && val > 0) {
 	runStart();
@@ -212,9 +331,32 @@ void runNewInput(uint16_t setpoint) {
 	setpoint = filteredSetpoint;
     }
 
+    // center of the running range is stop, the halves run either way
+    if (p[BIDIRECTIONAL] && setpoint > pwmMinValue) {
+	int32_t half = (pwmHiValue - pwmLoValue) / 2;
+	int32_t val = (int32_t)setpoint - (pwmLoValue + pwmHiValue) / 2;
+	int8_t dir = 1;
+
+	if (val < 0) {
+	    val = -val;
+	    dir = -1;
+	}
+
+	// the deadband is stop (arms and aborts a start) and keeps the direction
+	if (val <= runBidirDeadband) {
+	    setpoint = pwmLoValue;
+	}
+	else {
+	    setpoint = pwmLoValue + (val - runBidirDeadband) * (pwmHiValue - pwmLoValue) / (half - runBidirDeadband);
+
+	    if (setpoint >= pwmMinStart)
+		runSetDirection(dir);
+	}
+    }
+
     if (state == ESC_STATE_RUNNING && setpoint != lastPwm) {
 	if (runMode == OPEN_LOOP) {
-	    fetSetDutyCycle(fetPeriod * (int32_t)(setpoint-pwmLoValue) / (int32_t)(pwmHiValue - pwmLoValue));
+	    fetSetDutyCycle((float)FET_DUTY_PERIOD * (int32_t)(setpoint-pwmLoValue) / (int32_t)(pwmHiValue - pwmLoValue));
 	}
 	else if (runMode == CLOSED_LOOP_RPM) {
 	    float target = p[PWM_RPM_SCALE] * (setpoint-pwmLoValue) / (pwmHiValue - pwmLoValue);
@@ -271,14 +413,34 @@ static inline void runWatchDog(void) {
     register uint32_t t, d, p;
 
     __asm volatile ("cpsid i");
-    t = timerMicros;
+    t = timerGetMicros();
     d = detectedCrossing;
     p = pwmValidMicros;
     __asm volatile ("cpsie i");
 
-    if (state == ESC_STATE_STARTING && fetGoodDetects > fetStartDetects) {
+    if (state == ESC_STATE_NOCOMM && fetCatching) {
+	// nothing to catch - start normally, unless the timer ISR caught it meanwhile
+	if (((t >= runStartMicros) ? (t - runStartMicros) : (TIMER_MASK - runStartMicros + t)) > FET_CATCH_TIMEOUT) {
+	    __asm volatile ("cpsid i");
+	    if (state == ESC_STATE_NOCOMM && fetCatching) {
+		fetCatching = 0;
+		timerCancelAlarm1();
+		state = ESC_STATE_STOPPED;
+		runStartMotor();
+	    }
+	    __asm volatile ("cpsie i");
+	}
+    }
+    else if (state == ESC_STATE_STARTING && fetGoodDetects > fetStartDetects) {
 	state = ESC_STATE_RUNNING;
 	digitalHi(statusLed);   // turn off
+
+	runStartTime = ((t >= runStartMicros) ? (t - runStartMicros) : (TIMER_MASK - runStartMicros + t)) / TIMER_MULT;
+
+	if (runReversing == 2) {
+	    runReverseTime = ((t >= runReverseMicros) ? (t - runReverseMicros) : (TIMER_MASK - runReverseMicros + t)) / TIMER_MULT;
+	    runReversing = 0;
+	}
     }
     else if (state >= ESC_STATE_STOPPED) {   // running or starting
 	d = (t >= d) ? (t - d) : (TIMER_MASK - d + t);
@@ -334,7 +496,7 @@ static inline int32_t runRpmPID(float rpm, float target) {
     float output;
 
     // feed forward
-    ff = ((target*target* p[FF1TERM] + target*p[FF2TERM]) / avgVolts) * fetPeriod;
+    ff = ((target*target* p[FF1TERM] + target*p[FF2TERM]) / avgVolts) * FET_DUTY_PERIOD;
 
     error = (target - rpm);
 
@@ -362,10 +524,10 @@ static inline int32_t runRpmPID(float rpm, float target) {
 	}
     }
 
-    output = ff + (rpmP + rpmI) * (1.0f / 1500.0f) * fetPeriod;
+    output = ff + (rpmP + rpmI) * (1.0f / 1500.0f) * FET_DUTY_PERIOD;
 
     // don't allow integral to continue to rise if at max output
-    if (output >= fetPeriod)
+    if (output >= FET_DUTY_PERIOD)
 	rpmI = iTerm;
 
     return output;
@@ -431,7 +593,7 @@ void runInit(void) {
     runMode = p[STARTUP_MODE];
 
     SysTick_Config(SystemCoreClock / RUN_FREQ);
-    NVIC_SetPriority(SysTick_IRQn, 2);	    // lower priority
+    NVIC_SetPriority(SysTick_IRQn, 3);	    // below the ADC DMA ISR
 
     // setup hardware watchdog
     runIWDGInit(20);
@@ -459,7 +621,8 @@ static inline int32_t runCurrentPID(int32_t duty) {
     if (pTerm < 0.0f)
 	pTerm = 0.0f;
 
-    duty = duty - iTerm - pTerm;
+    // terms are in timer ticks
+    duty = duty - (iTerm + pTerm) * ((float)FET_DUTY_PERIOD / fetPeriod);
 
     if (duty < 0)
 	duty = 0;
@@ -476,7 +639,7 @@ static inline  void runThrotLim(int32_t duty) {
 	// if current limiter is calibrated - best performance
 	if (p[CL1TERM] != 0.0f) {
 	    maxVolts = p[CL1TERM] + p[CL2TERM]*rpm + p[CL3TERM]*p[MAX_CURRENT] + p[CL4TERM]*rpm*maxCurrentSQRT + p[CL5TERM]*maxCurrentSQRT;
-	    maxDuty = maxVolts * (fetPeriod / avgVolts);
+	    maxDuty = maxVolts * (FET_DUTY_PERIOD / avgVolts);
 
 	    if (duty > maxDuty)
 		fetActualDutyCycle = maxDuty;
@@ -485,7 +648,7 @@ static inline  void runThrotLim(int32_t duty) {
 	}
 	// otherwise, use PID - less accurate, lower performance
 	else {
-	    fetActualDutyCycle += fetPeriod * (RUN_MAX_DUTY_INCREASE * 0.01f);
+	    fetActualDutyCycle += FET_DUTY_PERIOD * (RUN_MAX_DUTY_INCREASE * 0.01f);
 	    if (fetActualDutyCycle > duty)
 		fetActualDutyCycle = duty;
 	    fetActualDutyCycle = runCurrentPID(fetActualDutyCycle);
@@ -515,9 +678,16 @@ void SysTick_Handler(void) {
 
 	runRpm();
 
+	if (runReversing)
+	    runReverse();
+
+	fetScheduleSwitchFreq(rpm, fetActualDutyCycle);
+
 	runThrotLim(fetDutyCycle);
     }
 
+    binaryCaptureSample();
+
     if (!(runCount % (10 * 1000 / RUN_FREQ))) {
 	idlePercent = 100.0f * (idleCounter-oldIdleCounter) / (SystemCoreClock * 10 / RUN_FREQ / minCycles);
 	oldIdleCounter = idleCounter;
@@ -562,6 +732,14 @@ void runSetConstants(void) {
     p[STARTUP_MODE] = startupMode;
     p[MAX_CURRENT] = maxCurrent;
     p[ESC_ID] = escId;
+    p[BIDIRECTIONAL] = (p[BIDIRECTIONAL] > 0.0f) ? 1.0f : 0.0f;
+
+    // at most a quarter of the running range
+    if (p[BIDIR_DEADBAND] < 0.0f)
+	p[BIDIR_DEADBAND] = 0.0f;
+    else if (p[BIDIR_DEADBAND] > (p[PWM_HI_VALUE] - p[PWM_LO_VALUE]) / 4)
+	p[BIDIR_DEADBAND] = (int)((p[PWM_HI_VALUE] - p[PWM_LO_VALUE]) / 4);
+    runBidirDeadband = p[BIDIR_DEADBAND] = (int)p[BIDIR_DEADBAND];
 
     // Calculate MAX_THRUST from PWM_RPM_SCALE (which is MAX_RPM) and THRxTERMs
     // Based on "thrust = rpm * a1 + rpm^2 * a2"
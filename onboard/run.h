@@ -25,6 +25,7 @@
 #define RUN_ARM_COUNT		20		    // number of valid PWM signals seen before arming
 #define RUN_MIN_MAX_CURRENT	0.0		    // Amps
 #define RUN_MAX_MAX_CURRENT	75.0		    // Amps
+#define RUN_REVERSE_RPM		300.0f		    // brake down to this before restarting in the other direction
 
 //#define RUN_ENABLE_IWDG
 #define RUN_LSI_FREQ		40000		    // 40 KHz LSI for IWDG
@@ -50,6 +51,12 @@ extern float rpm;
 extern float targetRpm;
 extern float runRPMFactor;
 extern uint8_t disarmReason;
+extern uint32_t runStartMicros;
+extern uint32_t runStartTime;
+extern uint32_t runFirstDetectTime;
+extern uint32_t runFailedStarts;
+extern uint32_t runReverseTime;
+extern volatile uint8_t runReversing;
 extern uint8_t commandMode;
 extern uint8_t escId;
 volatile extern uint8_t runMode;
@@ -65,6 +72,7 @@ extern void runRpmPIDReset(void);
 extern void runSetConstants(void);
 extern uint16_t runIWDGInit(int ms);
 extern void runFeedIWDG(void);
+extern float runSetpointTarget(uint8_t mode, uint16_t val);
 extern void runSetpoint(uint16_t val);
 
 #endif
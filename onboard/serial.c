@@ -18,24 +18,38 @@
 
 #include "serial.h"
 #include "config.h"
+#include "timer.h"
 #include "stm32f10x_dma.h"
 #include "misc.h"
 #include <stdio.h>
 #include <stdlib.h>
 
 serialPort_t serialPort;
+volatile uint32_t serialRxMicros;	    // timer ticks at the last rx wakeup
+serialRxTask_t *serialRxTask;
 
 void serialStartTxDMA() {
     serialPort_t *s = &serialPort;
 
+    // skip the unused end left by a wrapped frame
+    if (s->txTail == s->txWrap) {
+	s->txTail = 0;
+	s->txWrap = SERIAL_TX_BUFSIZE;
+    }
+
+    if (s->txHead == s->txTail)
+	return;
+
+    s->txDma = s->txTail;
     SERIAL_TX_DMA->CMAR = (uint32_t)&s->txBuf[s->txTail];
     if (s->txHead > s->txTail) {
 	SERIAL_TX_DMA->CNDTR = s->txHead - s->txTail;
 	s->txTail = s->txHead;
     }
     else {
-	SERIAL_TX_DMA->CNDTR = SERIAL_TX_BUFSIZE - s->txTail;
+	SERIAL_TX_DMA->CNDTR = s->txWrap - s->txTail;
 	s->txTail = 0;
+	s->txWrap = SERIAL_TX_BUFSIZE;
     }
 
     DMA_Cmd(SERIAL_TX_DMA, ENABLE);
@@ -51,6 +65,64 @@ void serialWrite(int ch) {
 	serialStartTxDMA();
 }
 
+// Reserve len contiguous bytes of the tx buffer for a frame to be built
+// in place.  Returns 0 if there is no room, the frame is then dropped.
+// Nothing else may be written until the frame is committed; a frame
+// that is not committed costs nothing.
+unsigned char *serialReserve(unsigned int len) {
+    serialPort_t *s = &serialPort;
+    unsigned int limit;
+
+    // oldest byte still needed
+    limit = (SERIAL_TX_DMA->CCR & 1) ? s->txDma : s->txTail;
+
+    if (s->txHead >= limit) {
+	if (s->txHead + len < SERIAL_TX_BUFSIZE)
+	    s->txResPos = s->txHead;
+	else if (len < limit)
+	    s->txResPos = 0;
+	else
+	    return 0;
+    }
+    else if (s->txHead + len < limit) {
+	s->txResPos = s->txHead;
+    }
+    else {
+	return 0;
+    }
+
+    return (unsigned char *)&s->txBuf[s->txResPos];
+}
+
+// hand the first len bytes of the reserved frame to the DMA
+void serialCommit(unsigned int len) {
+    serialPort_t *s = &serialPort;
+
+    __asm volatile ("cpsid i");
+
+    if (s->txResPos != s->txHead)
+	s->txWrap = s->txHead;
+    s->txHead = (s->txResPos + len) % SERIAL_TX_BUFSIZE;
+
+    if (!(SERIAL_TX_DMA->CCR & 1))
+	serialStartTxDMA();
+
+    __asm volatile ("cpsie i");
+}
+
+// CRC16-CCITT (0x1021)
+uint16_t serialCrc16(const unsigned char *buf, unsigned int len, uint16_t crc) {
+    int i;
+
+    while (len--) {
+	crc ^= (uint16_t)*buf++ << 8;
+	for (i = 0; i < 8; i++)
+	    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+
+    return crc;
+}
+
 unsigned char serialAvailable() {
     return (SERIAL_RX_DMA->CNDTR != serialPort.rxPos);
 }
@@ -108,15 +180,29 @@ void serialInit(void) {
     GPIO_InitStructure.GPIO_Mode = GPIO_Mode_IPU;
     GPIO_Init(SERIAL_UART_PORT, &GPIO_InitStructure);
 
+    // rx wakeups, the idle line and DMA half / full events
+    NVIC_InitStructure.NVIC_IRQChannel = SERIAL_UART_IRQ;
+    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 3;
+    NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+    NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+    NVIC_Init(&NVIC_InitStructure);
+
+    NVIC_InitStructure.NVIC_IRQChannel = SERIAL_RX_DMA_IRQ;
+    NVIC_Init(&NVIC_InitStructure);
+
+    // the rx task runs from PendSV so it never delays the motor
+    NVIC_SetPriority(PendSV_IRQn, SERIAL_RX_TASK_PRIORITY);
+
     // Enable the DMA1_Channel4 global Interrupt
     NVIC_InitStructure.NVIC_IRQChannel = DMA1_Channel4_IRQn;
-    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 2;
+    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 3;
     NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
     NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
     NVIC_Init(&NVIC_InitStructure);
 
     s->rxHead = s->rxTail = 0;
     s->txHead = s->txTail = 0;
+    s->txWrap = SERIAL_TX_BUFSIZE;
 
     serialOpenPort(p[BAUD_RATE]);
 
@@ -132,6 +218,7 @@ void serialInit(void) {
     DMA_InitStructure.DMA_BufferSize = SERIAL_RX_BUFSIZE;
     DMA_InitStructure.DMA_Mode = DMA_Mode_Circular;
     DMA_Init(SERIAL_RX_DMA, &DMA_InitStructure);
+    DMA_ITConfig(SERIAL_RX_DMA, DMA_IT_HT | DMA_IT_TC, ENABLE);
 
     DMA_Cmd(SERIAL_RX_DMA, ENABLE);
 
@@ -153,6 +240,8 @@ void serialInit(void) {
 
     USART_DMACmd(SERIAL_UART, USART_DMAReq_Tx, ENABLE);
 
+    USART_ITConfig(SERIAL_UART, USART_IT_IDLE, ENABLE);
+
     USART_Cmd(SERIAL_UART, ENABLE);
 }
 
@@ -165,6 +254,38 @@ void DMA1_Channel4_IRQHandler(void) {
 	serialStartTxDMA();
 }
 
+// the task is run soon after a pause in rx or a half buffer of data
+void serialSetRxTask(serialRxTask_t *task) {
+    serialRxTask = task;
+}
+
+void serialRxWake(void) {
+    SCB->ICSR = SCB_ICSR_PENDSVSET;
+}
+
+// USART idle line IRQ - a frame has ended
+void SERIAL_UART_ISR(void) {
+    // cleared by reading SR then DR
+    (void)SERIAL_UART->SR;
+    (void)SERIAL_UART->DR;
+
+    serialRxMicros = timerGetMicros();
+    serialRxWake();
+}
+
+// USART rx DMA IRQ - keep up with long bursts
+void SERIAL_RX_DMA_ISR(void) {
+    DMA_ClearITPendingBit(DMA1_IT_HT5 | DMA1_IT_TC5);
+
+    serialRxMicros = timerGetMicros();
+    serialRxWake();
+}
+
+void PendSV_Handler(void) {
+    if (serialRxTask)
+	serialRxTask();
+}
+
 void serialSetConstants(void) {
     p[BAUD_RATE] = (int)p[BAUD_RATE];
 
@@ -174,4 +295,4 @@ void serialSetConstants(void) {
 	p[BAUD_RATE] = SERIAL_MAX_BAUD;
 
     serialOpenPort(p[BAUD_RATE]);
-}
\ No newline at end of file
+}
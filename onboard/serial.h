@@ -30,6 +30,11 @@
 //#define SERIAL_UART_RTS_PIN	GPIO_Pin_12
 #define SERIAL_TX_DMA		DMA1_Channel4
 #define SERIAL_RX_DMA		DMA1_Channel5
+#define SERIAL_RX_DMA_IRQ	DMA1_Channel5_IRQn
+#define SERIAL_RX_DMA_ISR	DMA1_Channel5_IRQHandler
+#define SERIAL_UART_IRQ		USART1_IRQn
+#define SERIAL_UART_ISR		USART1_IRQHandler
+#define SERIAL_RX_TASK_PRIORITY	4		    // below everything but the idle loop
 
 #define SERIAL_MIN_BAUD		9600
 #define SERIAL_MAX_BAUD		921600
@@ -40,17 +45,29 @@
 typedef struct {
     volatile unsigned char txBuf[SERIAL_TX_BUFSIZE];
     unsigned int txHead, txTail;
+    volatile unsigned int txWrap;	    // end of data when a frame wrapped early to the start
+    volatile unsigned int txDma;	    // start of the block being sent
+    unsigned int txResPos;		    // open frame reservation
     volatile unsigned char rxBuf[SERIAL_RX_BUFSIZE];
     volatile unsigned int rxHead, rxTail;
     unsigned int rxPos;
 } serialPort_t;
 
+typedef void serialRxTask_t(void);
+
+extern volatile uint32_t serialRxMicros;
+
 extern void serialInit(void);
 extern void serialWrite(int ch);
 extern void serialPrint(const char *str);
+extern unsigned char *serialReserve(unsigned int len);
+extern void serialCommit(unsigned int len);
+extern uint16_t serialCrc16(const unsigned char *buf, unsigned int len, uint16_t crc);
 extern unsigned char serialAvailable();
 extern int serialRead();
 extern void serialSetConstants(void);
+extern void serialSetRxTask(serialRxTask_t *task);
+extern void serialRxWake(void);
 
 
 #endif
@@ -22,22 +22,34 @@
 
 timerStruct_t timerData;
 volatile uint32_t timerMicros;
-
-// must be called at least once every 65536 ticks in order for this strategy to work
-// TODO - consider interrupt interference
+volatile uint16_t timerHiBits;	    // counter overflows, maintained by the update interrupt
+
+// software alarm queue - binary min-heap ordered by deadline
+timerEvent_t *timerHeap[TIMER_MAX_EVENTS];
+uint8_t timerHeapSize;
+uint32_t timerQueueClock;
+uint16_t timerQueueCnt;
+uint32_t timerEventLate;	    // ticks, last callback
+uint32_t timerEventMaxLate;	    // ticks, worst callback
+
+// Lock free, callable from any context including with interrupts
+// disabled.  The high half comes from the update interrupt; should it
+// be pending but not yet serviced (we are at or above its priority)
+// the overflow flag accounts for it.  The counter is read before the
+// flag so a wrap in between leaves a high count and is not counted twice.
 uint32_t timerGetMicros(void) {
-    static uint16_t timerLast;
-    static uint16_t hiBits;
-    register uint16_t tmp;
-
-    tmp = TIMER_TIM->CNT;
+    register uint16_t hi, cnt, sr;
 
-    if (tmp < timerLast)
-	    hiBits++;
+    do {
+	hi = timerHiBits;
+	cnt = TIMER_TIM->CNT;
+	sr = TIMER_TIM->SR;
+    } while (hi != timerHiBits);
 
-    timerLast = tmp;
+    if ((sr & TIM_IT_Update) && cnt < 0x8000)
+	hi++;
 
-    timerMicros = (hiBits<<16 | tmp) & TIMER_MASK;
+    timerMicros = ((uint32_t)hi<<16 | cnt) & TIMER_MASK;
 
     return timerMicros;
 }
@@ -56,17 +68,17 @@ void timerDelay(uint16_t us) {
 }
 
 void timerCancelAlarm1(void) {
-    TIMER_TIM->DIER &= (uint16_t)~TIM_IT_CC1;
+    *TIMER_DIER_BITBAND(1) = 0;
     TIM_ClearITPendingBit(TIMER_TIM, TIM_IT_CC1);
 }
 
 void timerCancelAlarm2(void) {
-    TIMER_TIM->DIER &= (uint16_t)~TIM_IT_CC2;
+    *TIMER_DIER_BITBAND(2) = 0;
     TIM_ClearITPendingBit(TIMER_TIM, TIM_IT_CC2);
 }
 
 void timerCancelAlarm3(void) {
-    TIMER_TIM->DIER &= (uint16_t)~TIM_IT_CC3;
+    *TIMER_DIER_BITBAND(3) = 0;
     TIM_ClearITPendingBit(TIMER_TIM, TIM_IT_CC3);
 }
 
@@ -74,6 +86,199 @@ uint8_t timerAlarmActive3(void) {
     return (TIMER_TIM->DIER & TIM_IT_CC3);
 }
 
+// 32 bit clock private to the queue.  It is advanced on every queue
+// operation and the compare channel never waits more than TIMER_MAX_HOP,
+// so it can not miss a counter wrap while anything is queued.  All
+// deadlines are compared as signed differences, which handles rollover.
+// Interrupts must be disabled.
+static inline uint32_t timerQueueNow(void) {
+    uint16_t cnt = TIMER_TIM->CNT;
+
+    timerQueueClock += (uint16_t)(cnt - timerQueueCnt);
+    timerQueueCnt = cnt;
+
+    return timerQueueClock;
+}
+
+// nestable critical section, queue calls may come with interrupts already off
+static inline uint32_t timerLock(void) {
+    uint32_t primask;
+
+    __asm volatile ("mrs %0, primask" : "=r" (primask));
+    __asm volatile ("cpsid i");
+
+    return primask;
+}
+
+static inline void timerUnlock(uint32_t primask) {
+    __asm volatile ("msr primask, %0" : : "r" (primask));
+}
+
+static inline int8_t timerBefore(timerEvent_t *a, timerEvent_t *b) {
+    return ((int32_t)(a->when - b->when) < 0);
+}
+
+static inline void timerHeapSet(int i, timerEvent_t *e) {
+    timerHeap[i] = e;
+    e->index = i + 1;
+}
+
+static void timerHeapUp(int i) {
+    timerEvent_t *e = timerHeap[i];
+    int parent;
+
+    while (i > 0) {
+	parent = (i - 1) / 2;
+	if (!timerBefore(e, timerHeap[parent]))
+	    break;
+	timerHeapSet(i, timerHeap[parent]);
+	i = parent;
+    }
+    timerHeapSet(i, e);
+}
+
+static void timerHeapDown(int i) {
+    timerEvent_t *e = timerHeap[i];
+    int child;
+
+    while ((child = i*2 + 1) < timerHeapSize) {
+	if (child + 1 < timerHeapSize && timerBefore(timerHeap[child+1], timerHeap[child]))
+	    child++;
+	if (!timerBefore(timerHeap[child], e))
+	    break;
+	timerHeapSet(i, timerHeap[child]);
+	i = child;
+    }
+    timerHeapSet(i, e);
+}
+
+static void timerHeapRemove(timerEvent_t *e) {
+    int i = e->index - 1;
+
+    e->index = 0;
+
+    if (--timerHeapSize > i) {
+	e = timerHeap[timerHeapSize];
+	timerHeapSet(i, e);
+	timerHeapUp(i);
+	timerHeapDown(e->index - 1);
+    }
+}
+
+// point compare channel 4 at the earliest deadline, returns 0 if it is already due
+static uint8_t timerQueueArm(void) {
+    int32_t ticks;
+
+    if (!timerHeapSize) {
+	*TIMER_DIER_BITBAND(4) = 0;
+	return 1;
+    }
+
+    ticks = timerHeap[0]->when - timerQueueNow();
+    if (ticks < TIMER_MULT)
+	return 0;
+    if (ticks > TIMER_MAX_HOP)
+	ticks = TIMER_MAX_HOP;
+
+    TIMER_TIM->CCR4 = timerQueueCnt + ticks;
+    TIMER_TIM->SR = (uint16_t)~TIM_IT_CC4;
+    *TIMER_DIER_BITBAND(4) = 1;
+
+    // make sure we did not just step over it
+    if ((int16_t)(TIMER_TIM->CCR4 - TIMER_TIM->CNT) <= 0)
+	return 0;
+
+    return 1;
+}
+
+// run everything that is due, called from the timer ISR
+static void timerQueueRun(void) {
+    timerEvent_t *e;
+    uint32_t now;
+
+    do {
+	now = timerQueueNow();
+
+	while (timerHeapSize && (int32_t)(timerHeap[0]->when - now) <= 0) {
+	    e = timerHeap[0];
+	    timerHeapRemove(e);
+
+	    timerEventLate = now - e->when;
+	    if (timerEventLate > timerEventMaxLate)
+		timerEventMaxLate = timerEventLate;
+
+	    // may reschedule itself or others
+	    e->callback(e->parameter);
+
+	    now = timerQueueNow();
+	}
+    } while (!timerQueueArm());
+}
+
+uint8_t timerScheduled(timerEvent_t *e) {
+    return (e->index != 0);
+}
+
+void timerCancel(timerEvent_t *e) {
+    uint32_t primask = timerLock();
+
+    if (e->index) {
+	timerHeapRemove(e);
+	timerQueueArm();
+    }
+
+    timerUnlock(primask);
+}
+
+// schedule a software alarm, replacing it if already queued.  Callbacks
+// run in the timer ISR at TIMER_IRQ_PRIORITY and must be short.
+uint8_t timerSchedule(timerEvent_t *e, int32_t ticks, timerCallback_t *callback, int parameter) {
+    uint32_t primask = timerLock();
+    uint8_t ret = 1;
+
+    if (e->index)
+	timerHeapRemove(e);
+
+    if (timerHeapSize < TIMER_MAX_EVENTS) {
+	e->when = timerQueueNow() + ticks;
+	e->callback = callback;
+	e->parameter = parameter;
+
+	timerHeapSet(timerHeapSize++, e);
+	timerHeapUp(timerHeapSize - 1);
+
+	// already due, let the ISR have it
+	if (!timerQueueArm()) {
+	    *TIMER_DIER_BITBAND(4) = 1;
+	    TIMER_TIM->EGR = TIM_EventSource_CC4;
+	}
+    }
+    else {
+	ret = 0;
+    }
+
+    timerUnlock(primask);
+
+    return ret;
+}
+
+// (re)start a task from the top, its first step runs from the timer ISR
+void timerTaskStart(timerTask_t *t, timerCallback_t *func, int parameter) {
+    timerCancel(&t->event);
+    t->func = func;
+    t->resume = 0;
+    timerSchedule(&t->event, 0, func, parameter);
+}
+
+void timerTaskCancel(timerTask_t *t) {
+    timerCancel(&t->event);
+    t->resume = 0;
+}
+
+uint8_t timerTaskBusy(timerTask_t *t) {
+    return (t->resume != 0 || timerScheduled(&t->event));
+}
+
 // Create a timer
 void timerInit(void) {
     NVIC_InitTypeDef NVIC_InitStructure;
@@ -86,6 +291,7 @@ void timerInit(void) {
     NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
     NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
     NVIC_Init(&NVIC_InitStructure);
+    NVIC_SetPriority(TIMER_IRQ_CH, TIMER_IRQ_PRIORITY);
 
     // Time base configuration
     TIM_TimeBaseStructure.TIM_Prescaler = (72/TIMER_MULT) - 1;
@@ -113,18 +319,30 @@ void timerInit(void) {
     TIM_OC3Init(TIMER_TIM, &TIM_OCInitStructure);
     TIM_OC3PreloadConfig(TIMER_TIM, TIM_OCPreload_Disable);
 
+    // software alarm queue, no output
+    *TIMER_DIER_BITBAND(4) = 0;
+    TIM_OCInitStructure.TIM_OutputState = TIM_OutputState_Disable;
+    TIM_OC4Init(TIMER_TIM, &TIM_OCInitStructure);
+    TIM_OC4PreloadConfig(TIMER_TIM, TIM_OCPreload_Disable);
+    timerQueueCnt = TIMER_TIM->CNT;
+
     TIM_ARRPreloadConfig(TIMER_TIM, ENABLE);
 
+    // extend the counter to 32 bits
+    TIM_ClearITPendingBit(TIMER_TIM, TIM_IT_Update);
+    TIM_ITConfig(TIMER_TIM, TIM_IT_Update, ENABLE);
+
     // go...
     TIM_Cmd(TIMER_TIM, ENABLE);
 }
 
-// TODO: worry about 32 bit rollover
+// hardware alarms 1-3 are limited to 16 bits of ticks, longer or
+// additional timed events belong in the software alarm queue
 void timerSetAlarm1(int32_t ticks, timerCallback_t *callback, int parameter) {
     // do it now
     if (ticks <= TIMER_MULT) {
 	// Disable the Interrupt
-	TIMER_TIM->DIER &= (uint16_t)~TIM_IT_CC1;
+	*TIMER_DIER_BITBAND(1) = 0;
 
 	callback(parameter);
     }
@@ -136,7 +354,7 @@ void timerSetAlarm1(int32_t ticks, timerCallback_t *callback, int parameter) {
 	TIMER_TIM->CCR1 = TIMER_TIM->CNT + ticks;
 	TIMER_TIM->SR = (uint16_t)~TIM_IT_CC1;
 
-	TIMER_TIM->DIER |= TIM_IT_CC1;
+	*TIMER_DIER_BITBAND(1) = 1;
     }
 }
 
@@ -144,7 +362,7 @@ void timerSetAlarm2(int32_t ticks, timerCallback_t *callback, int parameter) {
     // do it now
     if (ticks <= TIMER_MULT) {
 	// Disable the Interrupt
-	TIMER_TIM->DIER &= (uint16_t)~TIM_IT_CC2;
+	*TIMER_DIER_BITBAND(2) = 0;
 
 	callback(parameter);
     }
@@ -155,7 +373,7 @@ void timerSetAlarm2(int32_t ticks, timerCallback_t *callback, int parameter) {
 
 	TIMER_TIM->CCR2 = TIMER_TIM->CNT + ticks;
 	TIMER_TIM->SR = (uint16_t)~TIM_IT_CC2;
-	TIMER_TIM->DIER |= TIM_IT_CC2;
+	*TIMER_DIER_BITBAND(2) = 1;
     }
 }
 
@@ -163,7 +381,7 @@ void timerSetAlarm3(int32_t ticks, timerCallback_t *callback, int parameter) {
     // do it now
     if (ticks <= TIMER_MULT) {
 	// Disable the Interrupt
-	TIMER_TIM->DIER &= (uint16_t)~TIM_IT_CC3;
+	*TIMER_DIER_BITBAND(3) = 0;
 
 	callback(parameter);
     }
@@ -174,16 +392,21 @@ void timerSetAlarm3(int32_t ticks, timerCallback_t *callback, int parameter) {
 
 	TIMER_TIM->CCR3 = TIMER_TIM->CNT + ticks;
 	TIMER_TIM->SR = (uint16_t)~TIM_IT_CC3;
-	TIMER_TIM->DIER |= TIM_IT_CC3;
+	*TIMER_DIER_BITBAND(3) = 1;
     }
 }
 
 void TIMER_ISR(void) {
+    if (TIMER_TIM->SR & TIM_IT_Update) {
+	timerHiBits++;
+	TIMER_TIM->SR = (uint16_t)~TIM_IT_Update;
+    }
+
     if (TIM_GetITStatus(TIMER_TIM, TIM_IT_CC1) != RESET) {
 	TIMER_TIM->SR = (uint16_t)~TIM_IT_CC1;
 
 	// Disable the Interrupt
-	TIMER_TIM->DIER &= (uint16_t)~TIM_IT_CC1;
+	*TIMER_DIER_BITBAND(1) = 0;
 
 	timerData.alarm1Callback(timerData.alarm1Parameter);
     }
@@ -191,7 +414,7 @@ void TIMER_ISR(void) {
 	TIMER_TIM->SR = (uint16_t)~TIM_IT_CC2;
 
 	// Disable the Interrupt
-	TIMER_TIM->DIER &= (uint16_t)~TIM_IT_CC2;
+	*TIMER_DIER_BITBAND(2) = 0;
 
 	timerData.alarm2Callback(timerData.alarm2Parameter);
     }
@@ -199,8 +422,13 @@ void TIMER_ISR(void) {
 	TIMER_TIM->SR = (uint16_t)~TIM_IT_CC3;
 
 	// Disable the Interrupt
-	TIMER_TIM->DIER &= (uint16_t)~TIM_IT_CC3;
+	*TIMER_DIER_BITBAND(3) = 0;
 
 	timerData.alarm3Callback(timerData.alarm3Parameter);
     }
+    else if (TIM_GetITStatus(TIMER_TIM, TIM_IT_CC4) != RESET) {
+	TIMER_TIM->SR = (uint16_t)~TIM_IT_CC4;
+
+	timerQueueRun();
+    }
 }
@@ -26,9 +26,49 @@
 #define TIMER_ISR	    TIM2_IRQHandler
 #define TIMER_MULT	    2//4		    // 0.5 us resolution
 #define TIMER_MASK	    0xFFFFFFFF	    // for testing timer roll-over
+#define TIMER_IRQ_PRIORITY  0		    // must preempt the ADC DMA ISR for jitter free commutation
+
+// bit band address of the TIMER_TIM->DIER compare interrupt enables (atomic against preemption)
+#define TIMER_DIER_BITBAND(n)	((volatile uint32_t *)(0x42000000 + (0x0000C*32) + ((n)*4)))
+
+#define TIMER_MAX_EVENTS    8		    // software alarms multiplexed on compare channel 4
+#define TIMER_MAX_HOP	    0x8000	    // longest single compare step, keeps the queue clock unambiguous
 
 typedef void timerCallback_t(int);
 
+// software alarm, storage belongs to the caller
+typedef struct {
+    uint32_t when;			    // queue clock ticks
+    timerCallback_t *callback;
+    int parameter;
+    uint8_t index;			    // heap position + 1, 0 when idle (zero initialized is idle)
+} timerEvent_t;
+
+// Cooperative task: a sequence written linearly that sleeps between
+// steps on a software alarm instead of spinning.  Steps run in the
+// timer ISR.  Locals do not survive a yield, keep state in statics.
+// If a delay cannot be scheduled (alarm queue full) the task is
+// abandoned and the code after TIMER_TASK_END runs to clean up.
+//
+//  void fooRun(int parameter) {
+//	TIMER_TASK_BEGIN(&fooTask);
+//	...
+//	TIMER_TASK_DELAY(&fooTask, 1000);	// us
+//	...
+//	TIMER_TASK_END(&fooTask);
+//	// aborted
+//	...
+//  }
+typedef struct {
+    timerEvent_t event;
+    timerCallback_t *func;
+    uint16_t resume;			    // line to continue at, 0 == from the top
+} timerTask_t;
+
+#define TIMER_TASK_BEGIN(t)	switch ((t)->resume) { case 0:
+#define TIMER_TASK_DELAY(t, us)	do { (t)->resume = __LINE__; if (timerSchedule(&(t)->event, (us)*TIMER_MULT, (t)->func, (t)->event.parameter)) return; (t)->resume = 0; goto timerTaskAbort; case __LINE__:; } while (0)
+#define TIMER_TASK_END(t)	} (t)->resume = 0; return; timerTaskAbort:
+
 typedef struct {
     timerCallback_t *alarm1Callback;
     int alarm1Parameter;
@@ -41,6 +81,8 @@ typedef struct {
 } timerStruct_t;
 
 extern volatile uint32_t timerMicros;
+extern uint32_t timerEventLate;
+extern uint32_t timerEventMaxLate;
 
 extern void timerInit(void);
 extern void timerDelay(uint16_t us);
@@ -52,5 +94,11 @@ extern void timerCancelAlarm2(void);
 extern void timerCancelAlarm3(void);
 extern uint8_t timerAlarmActive3(void);
 extern uint32_t timerGetMicros(void);
+extern uint8_t timerSchedule(timerEvent_t *e, int32_t ticks, timerCallback_t *callback, int parameter);
+extern void timerCancel(timerEvent_t *e);
+extern uint8_t timerScheduled(timerEvent_t *e);
+extern void timerTaskStart(timerTask_t *t, timerCallback_t *func, int parameter);
+extern void timerTaskCancel(timerTask_t *t);
+extern uint8_t timerTaskBusy(timerTask_t *t);
 
 #endif